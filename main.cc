@@ -1,25 +1,329 @@
 #include <cstdio>
 #include <cmath>
 #include <cstring>
+#include <cstdlib>
 #include <map>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <algorithm>
+#include <complex>
+#include <chrono>
+#include <csignal>
+#include <limits>
+#include <type_traits>
+#include <climits>
+#include <set>
+#include <memory>
+#include <new>
+#include <cerrno>
 
 #ifndef WIN
 #include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #else
 #include <windows.h>
+#define strtok_r strtok_s
 #endif
 
+#include "sl_plugin.h"
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+inline unsigned int floatbits(float f) {
+    unsigned int u;
+    memcpy(&u, &f, 4);
+    return u;
+}
+
+inline float bitsfloat(unsigned int u) {
+    float f;
+    memcpy(&f, &u, 4);
+    return f;
+}
+
+struct bhalf;
+
+/* IEEE binary16, arithmetic happens in float */
+struct half {
+    half() : u(0) {}
+    half(float f) : u(fromfloat(f)) {}
+    half(const bhalf & b);
+    operator float() const { return tofloat(u); }
+    static unsigned short fromfloat(float f) {
+#ifdef __F16C__
+        return _cvtss_sh(f, 0);
+#else
+        unsigned int x = floatbits(f);
+        unsigned int s = (x >> 16) & 0x8000;
+        int e = ((x >> 23) & 0xff) - 127 + 15;
+        unsigned int m = x & 0x7fffff;
+        if( ((x >> 23) & 0xff) == 0xff ) return s | 0x7c00 | (m ? 0x200 | (m >> 13) : 0);
+        if( e >= 31 ) return s | 0x7c00;
+        if( e <= 0 ) {
+            if( e < -10 ) return s;
+            m |= 0x800000;
+            int sh = 14-e;
+            unsigned int r = m >> sh, rem = m & ((1u << sh)-1), hf = 1u << (sh-1);
+            if( rem > hf || (rem == hf && (r & 1)) ) r++;
+            return s | r;
+        }
+        unsigned int r = (e << 10) | (m >> 13), rem = m & 0x1fff;
+        if( rem > 0x1000 || (rem == 0x1000 && (r & 1)) ) r++;
+        return s | r;
+#endif
+    }
+    static float tofloat(unsigned short h) {
+#ifdef __F16C__
+        return _cvtsh_ss(h);
+#else
+        unsigned int s = (h & 0x8000) << 16, e = (h >> 10) & 0x1f, m = h & 0x3ff;
+        if( e == 0x1f ) return bitsfloat(s | 0x7f800000 | (m << 13) | (m ? 0x400000 : 0));
+        if( e == 0 ) {
+            float f = m*(1.0f/16777216.0f);
+            return s ? -f : f;
+        }
+        return bitsfloat(s | ((e+112) << 23) | (m << 13));
+#endif
+    }
+    unsigned short u;
+};
+
+/* bfloat16, the upper half of a float rounded to nearest even */
+struct bhalf {
+    bhalf() : u(0) {}
+    bhalf(float f) : u(fromfloat(f)) {}
+    bhalf(const half & h) : u(fromfloat((float)h)) {}
+    operator float() const { return tofloat(u); }
+    static unsigned short fromfloat(float f) {
+        unsigned int x = floatbits(f);
+        if( (x & 0x7fffffff) > 0x7f800000 ) return (x >> 16) | 0x40;
+        return (x+0x7fff+((x >> 16) & 1)) >> 16;
+    }
+    static float tofloat(unsigned short h) {
+        return bitsfloat((unsigned int)h << 16);
+    }
+    unsigned short u;
+};
+
+inline half::half(const bhalf & b) : u(fromfloat((float)b)) {}
+
+/* bytes in use and high-water marks per category, allocations past memlimit throw bad_alloc which fails the command */
+const int MEMNODES = 0, MEMBUFFERS = 1, MEMLITERALS = 2, MEMCACHES = 3;
+const char* memnames[] = {"nodes", "buffers", "literals", "caches"};
+std::atomic<long long> memused[4];
+std::atomic<long long> memhigh[4];
+long long memlimit = 0;
+
+void account(int cat, long long bytes) {
+    if( bytes > 0 && memlimit > 0 && memused[0]+memused[1]+memused[2]+memused[3]+bytes > memlimit ) throw std::bad_alloc();
+    long long u = memused[cat] += bytes;
+    long long h = memhigh[cat];
+    while( u > h && !memhigh[cat].compare_exchange_weak(h, u) ) {}
+}
+
+/* nodes allocated while an embedded session is active, freed with the session */
+thread_local std::set<void*>* owned = NULL;
+
+/* scratch space held for the duration of a computation */
+struct scratch {
+    scratch(long long b) : bytes(b) { account(MEMCACHES, bytes); }
+    ~scratch() { account(MEMCACHES, -bytes); }
+    long long bytes;
+};
+
+int hugepages = 1;
+const size_t hugesize = 2 << 20;
+std::map<void*,size_t> mapped;
+std::map<void*,size_t> allocated;
+std::mutex mappedm;
+
+/* 64 byte aligned storage, buffers of a huge page or more are mapped 2MB aligned and backed by transparent (1) or explicit (2) huge pages */
+void* rawalloc(size_t bytes) {
+#ifndef WIN
+    if( hugepages > 0 && bytes >= hugesize ) {
+        size_t len = (bytes+hugesize-1)/hugesize*hugesize;
+        void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if( hugepages == 2 ) p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+#endif
+        if( p == MAP_FAILED ) {
+            char* r = (char*)mmap(NULL, len+hugesize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            if( r != MAP_FAILED ) {
+                char* a = (char*)(((unsigned long long)r+hugesize-1)/hugesize*hugesize);
+                if( a > r ) munmap(r, a-r);
+                if( a+len < r+len+hugesize ) munmap(a+len, r+len+hugesize-(a+len));
+#ifdef MADV_HUGEPAGE
+                madvise(a, len, MADV_HUGEPAGE);
+#endif
+                p = a;
+            }
+        }
+        if( p != MAP_FAILED ) {
+            std::lock_guard<std::mutex> lk(mappedm);
+            mapped[p] = len;
+            return p;
+        }
+    }
+    void* p = NULL;
+    if( posix_memalign(&p, 64, bytes) != 0 ) return NULL;
+    return p;
+#else
+    return _aligned_malloc(bytes, 64);
+#endif
+}
+
+void rawfree(void* p) {
+#ifndef WIN
+    {
+        std::lock_guard<std::mutex> lk(mappedm);
+        std::map<void*,size_t>::iterator it = mapped.find(p);
+        if( it != mapped.end() ) {
+            munmap(p, it->second);
+            mapped.erase(it);
+            return;
+        }
+    }
+    free(p);
+#else
+    _aligned_free(p);
+#endif
+}
+
+void* slalloc(size_t bytes) {
+    if( bytes == 0 ) return NULL;
+    account(MEMBUFFERS, bytes);
+    void* p = rawalloc(bytes);
+    if( p == NULL ) {
+        account(MEMBUFFERS, -(long long)bytes);
+        throw std::bad_alloc();
+    }
+    std::lock_guard<std::mutex> lk(mappedm);
+    allocated[p] = bytes;
+    return p;
+}
+
+void slfree(void* p) {
+    if( p == NULL ) return;
+    {
+        std::lock_guard<std::mutex> lk(mappedm);
+        std::map<void*,size_t>::iterator it = allocated.find(p);
+        if( it != allocated.end() ) {
+            account(MEMBUFFERS, -(long long)it->second);
+            allocated.erase(it);
+        }
+    }
+    rawfree(p);
+}
+
+/* ranges written to a buffer, numbered from creation, entries every snapshot has counted are dropped */
+struct editlog {
+    editlog() : base(0) {}
+    size_t count() const { return base+log.size(); }
+    void since(size_t from, std::vector<std::pair<int,int> > & r) const {
+        size_t k = from > base ? from-base : 0;
+        if( k < log.size() ) r.assign(log.begin()+k, log.end());
+    }
+    void add(int lo, int hi) {
+        if( !log.empty() && (marks.empty() || *marks.rbegin() < count()) && lo <= log.back().second && hi >= log.back().first ) {
+            log.back().first = std::min(lo, log.back().first);
+            log.back().second = std::max(hi, log.back().second);
+        } else log.push_back(std::make_pair(lo, hi));
+        trim();
+    }
+    void hold(size_t at) { marks.insert(at); }
+    void release(size_t at) {
+        std::multiset<size_t>::iterator it = marks.find(at);
+        if( it != marks.end() ) marks.erase(it);
+        trim();
+    }
+    void trim() {
+        size_t keep = marks.empty() ? count() : *marks.begin();
+        if( keep > base ) {
+            log.erase(log.begin(), log.begin()+(keep-base));
+            base = keep;
+        }
+    }
+    size_t base;
+    std::vector<std::pair<int,int> > log;
+    std::multiset<size_t> marks;
+};
+
 class simlab {
 public:
     simlab() : type(0), length(0) {}
     simlab(int v) : type(v), length(0) {}
     simlab(int v, int l) : type(v), length(l) {}
+    virtual ~simlab() {}
+    /* not inlined, so cleanup after a throwing constructor pairs this operator delete with this operator new rather than ::operator new */
+    __attribute__((noinline)) static void* operator new(size_t n) {
+        account(MEMNODES, n);
+        void* p = ::operator new(n);
+        if( owned != NULL ) owned->insert(p);
+        return p;
+    }
+    static void operator delete(void* p, size_t n) {
+        if( owned != NULL ) owned->erase(p);
+        account(MEMNODES, -(long long)n);
+        ::operator delete(p, n);
+    }
+    virtual int inputs() const { return 0; }
+    virtual simlab* input(int k) const { return NULL; }
+    virtual bool pointwise() const { return false; }
+    virtual void* data() const { return NULL; }
+    /* widens a changed range [lo,hi) of input k to the outputs it can affect */
+    virtual void spread(int k, int & lo, int & hi) const {
+        if( !pointwise() ) {
+            lo = 0;
+            hi = INT_MAX;
+        }
+    }
+    /* ranges written since creation, for buffers that track their edits */
+    virtual std::shared_ptr<editlog> edits() const { return std::shared_ptr<editlog>(); }
     int type;
     int length;
 };
 
+/* node output cached for the thread evaluating a block, [s,s+n) of up to cap values, empty until the first get of the node */
+struct memo {
+    const simlab* node;
+    int s;
+    int n;
+    int cap;
+    void* data;
+};
+
+thread_local memo* memos = NULL;
+thread_local int nmemos = 0;
+
+/* installs a memo table on the calling thread, the previous one comes back even when the evaluation throws */
+struct memoscope {
+    memoscope(memo* m, int n) : pm(memos), pn(nmemos) {
+        memos = m;
+        nmemos = n;
+    }
+    ~memoscope() {
+        memos = pm;
+        nmemos = pn;
+    }
+    memo* pm;
+    int pn;
+};
+
 template<class T> class virtualbuffer : public simlab {
 public:
     virtualbuffer() : simlab(0) {}
@@ -32,12 +336,40 @@ public:
         return 0;
     }*/
     virtual void operator()(int i,T v) {}
+    virtual void fill(T* o, int s, int n) const {
+        for( int k = 0; k < n; k++ ) o[k] = (*this)[s+k];
+    }
+    /* fill, unless the range is already cached for this block; a memo of this node takes the first range asked for that fits */
+    void get(T* o, int s, int n) const {
+        for( int k = 0; k < nmemos; k++ ) {
+            memo & m = memos[k];
+            if( m.node != this ) continue;
+            if( s >= m.s && s+n <= m.s+m.n ) {
+                memcpy(o, (const T*)m.data+(s-m.s), n*sizeof(T));
+                return;
+            }
+            if( m.n == 0 && n <= m.cap ) {
+                fill((T*)m.data, s, n);
+                m.s = s;
+                m.n = n;
+                memcpy(o, m.data, n*sizeof(T));
+                return;
+            }
+            break;
+        }
+        fill(o, s, n);
+    }
 };
 
 template<class T> class buffer : public virtualbuffer<T> {
 public:
-    buffer() : virtualbuffer<T>(0), buf(0) {}
-    buffer(int size) : virtualbuffer<T>(0,size), buf(0) {}
+    buffer() : virtualbuffer<T>(0), buf(0), mem(0) {}
+    buffer(int size) : virtualbuffer<T>(0,size), buf(0), mem(0) {}
+    buffer(const buffer &) = delete;
+    buffer & operator=(const buffer &) = delete;
+    ~buffer() {
+        slfree(mem);
+    }
     virtual T operator[](int i) const {
         return buf[i];
     }
@@ -46,8 +378,22 @@ public:
     }
     virtual void operator()(int i,T v) {
         buf[i] = v;
+        touched(i, i+1);
+    }
+    virtual void fill(T* o, int s, int n) const {
+        memcpy(o, buf+s, n*sizeof(T));
+    }
+    virtual void* data() const { return buf; }
+    virtual std::shared_ptr<editlog> edits() const {
+        if( !log ) log = std::make_shared<editlog>();
+        return log;
+    }
+    void touched(int lo, int hi) {
+        edits()->add(lo, hi);
     }
     T* buf;
+    T* mem;
+    mutable std::shared_ptr<editlog> log;
 };
 
 template<> virtualbuffer<unsigned char>::virtualbuffer() : simlab(8) {}
@@ -60,17 +406,21 @@ template<> virtualbuffer<float>::virtualbuffer() : simlab(34) {}
 template<> virtualbuffer<unsigned long long>::virtualbuffer() : simlab(64) {}
 template<> virtualbuffer<long long>::virtualbuffer() : simlab(65) {}
 template<> virtualbuffer<double>::virtualbuffer() : simlab(66) {}
-
-template<> buffer<unsigned char>::buffer(int size) : virtualbuffer(8,size), buf((unsigned char*)realloc(NULL, size*sizeof(unsigned char))) {}
-template<> buffer<char>::buffer(int size) : virtualbuffer(9,size), buf((char*)realloc(NULL, size*sizeof(char))) {}
-template<> buffer<unsigned short>::buffer(int size) : virtualbuffer(16,size), buf((unsigned short*)realloc(NULL, size*sizeof(unsigned short))) {}
-template<> buffer<short>::buffer(int size) : virtualbuffer(17,size), buf((short*)realloc(NULL, size*sizeof(short))) {}
-template<> buffer<unsigned int>::buffer(int size) : virtualbuffer(32,size), buf((unsigned int*)realloc(NULL, size*sizeof(unsigned int))) {}
-template<> buffer<int>::buffer(int size) : virtualbuffer(33,size), buf((int*)realloc(NULL, size*sizeof(int))) {}
-template<> buffer<float>::buffer(int size) : virtualbuffer(34,size), buf((float*)realloc(NULL, size*sizeof(float))) {}
-template<> buffer<unsigned long long>::buffer(int size) : virtualbuffer(64,size), buf((unsigned long long*)realloc(NULL, size*sizeof(unsigned long long))) {}
-template<> buffer<long long>::buffer(int size) : virtualbuffer(65,size), buf((long long*)realloc(NULL, size*sizeof(long long))) {}
-template<> buffer<double>::buffer(int size) : virtualbuffer(66,size), buf((double*)realloc(NULL, size*sizeof(double))) {}
+template<> virtualbuffer<half>::virtualbuffer() : simlab(18) {}
+template<> virtualbuffer<bhalf>::virtualbuffer() : simlab(19) {}
+
+template<> buffer<unsigned char>::buffer(int size) : virtualbuffer(8,size), buf((unsigned char*)slalloc(size*sizeof(unsigned char))), mem(buf) {}
+template<> buffer<char>::buffer(int size) : virtualbuffer(9,size), buf((char*)slalloc(size*sizeof(char))), mem(buf) {}
+template<> buffer<unsigned short>::buffer(int size) : virtualbuffer(16,size), buf((unsigned short*)slalloc(size*sizeof(unsigned short))), mem(buf) {}
+template<> buffer<short>::buffer(int size) : virtualbuffer(17,size), buf((short*)slalloc(size*sizeof(short))), mem(buf) {}
+template<> buffer<unsigned int>::buffer(int size) : virtualbuffer(32,size), buf((unsigned int*)slalloc(size*sizeof(unsigned int))), mem(buf) {}
+template<> buffer<int>::buffer(int size) : virtualbuffer(33,size), buf((int*)slalloc(size*sizeof(int))), mem(buf) {}
+template<> buffer<float>::buffer(int size) : virtualbuffer(34,size), buf((float*)slalloc(size*sizeof(float))), mem(buf) {}
+template<> buffer<unsigned long long>::buffer(int size) : virtualbuffer(64,size), buf((unsigned long long*)slalloc(size*sizeof(unsigned long long))), mem(buf) {}
+template<> buffer<long long>::buffer(int size) : virtualbuffer(65,size), buf((long long*)slalloc(size*sizeof(long long))), mem(buf) {}
+template<> buffer<double>::buffer(int size) : virtualbuffer(66,size), buf((double*)slalloc(size*sizeof(double))), mem(buf) {}
+template<> buffer<half>::buffer(int size) : virtualbuffer(18,size), buf((half*)slalloc(size*sizeof(half))), mem(buf) {}
+template<> buffer<bhalf>::buffer(int size) : virtualbuffer(19,size), buf((bhalf*)slalloc(size*sizeof(bhalf))), mem(buf) {}
 
 /*template<> class virtualbuffer<float> {
 public:
@@ -81,12 +431,190 @@ public:
     int type;
 };*/
 
+int threads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+int forknodes = 4;
+
+/* the first exception a task throws is kept and rethrown by wait, so a failed allocation on a worker fails the command */
+class taskgroup {
+public:
+    taskgroup() : pending(0) {}
+    std::atomic<int> pending;
+    std::mutex m;
+    std::exception_ptr error;
+};
+
+/* deque 0 is shared by outside threads, worker k owns deque k; owners pop the newest task, thieves take the oldest */
+class stealpool {
+public:
+    struct task {
+        std::function<void()> f;
+        taskgroup* g;
+    };
+    stealpool() : queued(0), workers(0) {
+        for( int k = 0; k < 64; k++ ) dq[k] = new std::deque<task>();
+    }
+    void ensure(int n) {
+        std::lock_guard<std::mutex> lk(startm);
+        if( n > 64 ) n = 64;
+        while( workers+1 < n ) {
+            workers++;
+            std::thread(&stealpool::worker, this, workers).detach();
+        }
+    }
+    void spawn(taskgroup & g, std::function<void()> f) {
+        g.pending++;
+        int q = self;
+        {
+            std::lock_guard<std::mutex> lk(qm[q]);
+            dq[q]->push_back(task{f,&g});
+        }
+        queued++;
+        idle.notify_one();
+    }
+    bool runone() {
+        task t;
+        bool found = false;
+        int me = self;
+        {
+            std::lock_guard<std::mutex> lk(qm[me]);
+            if( !dq[me]->empty() ) {
+                t = dq[me]->back();
+                dq[me]->pop_back();
+                found = true;
+            }
+        }
+        for( int k = 1; !found && k <= workers+1; k++ ) {
+            int v = (me+k)%(workers+1);
+            std::lock_guard<std::mutex> lk(qm[v]);
+            if( !dq[v]->empty() ) {
+                t = dq[v]->front();
+                dq[v]->pop_front();
+                found = true;
+            }
+        }
+        if( !found ) return false;
+        queued--;
+        try {
+            t.f();
+        } catch( ... ) {
+            std::lock_guard<std::mutex> lk(t.g->m);
+            if( !t.g->error ) t.g->error = std::current_exception();
+        }
+        t.g->pending--;
+        return true;
+    }
+    void wait(taskgroup & g) {
+        while( g.pending.load() > 0 ) {
+            if( !runone() ) std::this_thread::yield();
+        }
+        if( g.error ) std::rethrow_exception(g.error);
+    }
+    void worker(int id) {
+        self = id;
+        while( true ) {
+            if( !runone() ) {
+                std::unique_lock<std::mutex> lk(idlem);
+                idle.wait_for(lk, std::chrono::milliseconds(1), [&]() { return queued.load() > 0; });
+            }
+        }
+    }
+    /* held across fork so the child does not inherit a lock taken by a worker it will not have */
+    void hold() {
+        startm.lock();
+        for( int k = 0; k < 64; k++ ) qm[k].lock();
+        idlem.lock();
+    }
+    void release() {
+        idlem.unlock();
+        for( int k = 63; k >= 0; k-- ) qm[k].unlock();
+        startm.unlock();
+    }
+    /* a forked child has none of the workers, drop them and whatever was queued */
+    void reset() {
+        for( int k = 0; k < 64; k++ ) dq[k]->clear();
+        queued = 0;
+        workers = 0;
+    }
+    static thread_local int self;
+    std::deque<task>* dq[64];
+    std::mutex qm[64];
+    std::atomic<int> queued;
+    int workers;
+    std::mutex startm;
+    std::mutex idlem;
+    std::condition_variable idle;
+};
+
+thread_local int stealpool::self = 0;
+stealpool & pool = *new stealpool();
+
+template<class F> void parallel(int n, F f) {
+    int t = threads < n ? threads : n;
+    if( t <= 1 ) {
+        if( n > 0 ) f(0, n);
+        return;
+    }
+    pool.ensure(threads);
+    taskgroup g;
+    for( int k = 1; k < t; k++ ) {
+        int s = (int)((long long)n*k/t), e = (int)((long long)n*(k+1)/t);
+        pool.spawn(g, [&f,s,e]() { f(s, e); });
+    }
+    /* the spawned tasks refer to f and g, they have to finish before an exception leaves */
+    std::exception_ptr error;
+    try {
+        f(0, (int)((long long)n/t));
+    } catch( ... ) {
+        error = std::current_exception();
+    }
+    pool.wait(g);
+    if( error ) std::rethrow_exception(error);
+}
+
+template<class A,class B> void fork2(A a, B b) {
+    if( threads <= 1 ) {
+        a();
+        b();
+        return;
+    }
+    pool.ensure(threads);
+    taskgroup g;
+    pool.spawn(g, b);
+    std::exception_ptr error;
+    try {
+        a();
+    } catch( ... ) {
+        error = std::current_exception();
+    }
+    pool.wait(g);
+    if( error ) std::rethrow_exception(error);
+}
+
+int nodes(const simlab* sl, int cap) {
+    int n = 1;
+    for( int k = 0; k < sl->inputs() && n < cap; k++ ) n += nodes(sl->input(k), cap-n);
+    return n;
+}
+
+template<class T,class K,class F> inline void unary(const virtualbuffer<K> & a, T* o, int s, int n, F op) {
+    K v[1024];
+    for( int i = 0; i < n; i += 1024 ) {
+        int m = n-i < 1024 ? n-i : 1024;
+        a.get(v, s+i, m);
+        for( int k = 0; k < m; k++ ) o[i+k] = op(v[k]);
+    }
+}
+
 template<class T> class cnst : public virtualbuffer<T> {
 public:
     cnst(T co) : c(co) {}
     virtual T operator[](int i) const {
         return c;
     }
+    virtual void fill(T* o, int s, int n) const {
+        for( int k = 0; k < n; k++ ) o[k] = c;
+    }
+    virtual bool pointwise() const { return true; }
     T c;
 };
 
@@ -95,6 +623,9 @@ public:
     virtual int operator[](int i) const {
         return i;
     }
+    virtual void fill(int* o, int s, int n) const {
+        for( int k = 0; k < n; k++ ) o[k] = s+k;
+    }
 };
 
 class triangular : public virtualbuffer<int> {
@@ -126,17 +657,157 @@ public:
     }
 };
 
+/* philox4x32-10 applied to nb consecutive counters, kept in lanes so the rounds vectorize */
+inline void philox(unsigned int b0, int nb, unsigned int k, unsigned int (*w)[16]) {
+    unsigned int c0[16], c1[16], c2[16], c3[16];
+    for( int j = 0; j < nb; j++ ) {
+        c0[j] = b0+j;
+        c1[j] = 0;
+        c2[j] = 0;
+        c3[j] = 0;
+    }
+    unsigned int k0 = k, k1 = 0x2545f491;
+    for( int r = 0; r < 10; r++ ) {
+        for( int j = 0; j < nb; j++ ) {
+            unsigned long long p0 = (unsigned long long)0xD2511F53 * c0[j];
+            unsigned long long p1 = (unsigned long long)0xCD9E8D57 * c2[j];
+            unsigned int n0 = (unsigned int)(p1 >> 32) ^ c1[j] ^ k0;
+            unsigned int n2 = (unsigned int)(p0 >> 32) ^ c3[j] ^ k1;
+            c1[j] = (unsigned int)p1;
+            c3[j] = (unsigned int)p0;
+            c0[j] = n0;
+            c2[j] = n2;
+        }
+        k0 += 0x9E3779B9;
+        k1 += 0xBB67AE85;
+    }
+    for( int j = 0; j < nb; j++ ) {
+        w[0][j] = c0[j];
+        w[1][j] = c1[j];
+        w[2][j] = c2[j];
+        w[3][j] = c3[j];
+    }
+}
+
+template<class T> inline T uniform(unsigned long long u) {
+    if( std::numeric_limits<T>::is_integer ) return (T)u;
+    if( sizeof(T) > 4 ) return (T)((u >> 11) * (1.0/9007199254740992.0));
+    return (T)((u >> 8) * (1.0f/16777216.0f));
+}
+
+/* d rounded to nearest for integer types, saturated to their range so out of range values stay defined */
+template<class T> inline T rounded(double d) {
+    if( !std::numeric_limits<T>::is_integer ) return (T)d;
+    if( d != d ) return 0;
+    d = floor(d+0.5);
+    if( d <= (double)std::numeric_limits<T>::min() ) return std::numeric_limits<T>::min();
+    if( d >= (double)std::numeric_limits<T>::max() ) return std::numeric_limits<T>::max();
+    return (T)d;
+}
+
+template<class T> class rnd : public virtualbuffer<T> {
+public:
+    rnd(unsigned int s, bool n) : seed(s), normal(n), words(sizeof(T) > 4 ? 2 : 1) {}
+    virtual T operator[](int i) const {
+        T o[4];
+        blocks(i/(4/words), 1, o);
+        return o[i%(4/words)];
+    }
+    virtual void fill(T* o, int s, int n) const {
+        int per = 4/words;
+        T t[16*4];
+        int i = 0;
+        while( i < n ) {
+            int b = (s+i)/per;
+            int lane = (s+i)%per;
+            int nb = (lane+n-i+per-1)/per;
+            if( nb > 16 ) nb = 16;
+            blocks(b, nb, t);
+            int m = nb*per-lane < n-i ? nb*per-lane : n-i;
+            memcpy(o+i, t+lane, m*sizeof(T));
+            i += m;
+        }
+    }
+    void blocks(unsigned int b, int nb, T* o) const {
+        unsigned int w[4][16];
+        philox(b, nb, seed, w);
+        int per = 4/words;
+        for( int j = 0; j < nb; j++ ) {
+            unsigned long long u[4];
+            for( int k = 0; k < per; k++ ) u[k] = words == 1 ? w[k][j] : w[2*k][j] | (unsigned long long)w[2*k+1][j] << 32;
+            if( !normal ) {
+                for( int k = 0; k < per; k++ ) o[j*per+k] = uniform<T>(u[k]);
+            } else {
+                double scale = words == 1 ? 1.0/4294967296.0 : 1.0/18446744073709551616.0;
+                for( int k = 0; k < per; k += 2 ) {
+                    double r = sqrt(-2.0*log((u[k]+0.5)*scale));
+                    double a = 2.0*M_PI*((u[k+1]+0.5)*scale);
+                    double z0 = r*cos(a), z1 = r*sin(a);
+                    o[j*per+k] = rounded<T>(z0);
+                    o[j*per+k+1] = rounded<T>(z1);
+                }
+            }
+        }
+    }
+    unsigned int seed;
+    bool normal;
+    int words;
+};
+
 template<class T,class K> class map : public virtualbuffer<T> {
 public:
     map(virtualbuffer<K> & m) : a(m) {}
     virtual T operator[](int i) const {return a[i];}
+    virtual int inputs() const { return 1; }
+    virtual simlab* input(int k) const { return &a; }
     virtualbuffer<K> & a;
 };
 
+int prefetchdist = 16;
+int gathersort = 0;
+
+/* out[k] = src[ix[s+k]]; over materialized sources the index block is prefetched ahead and optionally visited in sorted order */
+template<class T,class I> void gather(const virtualbuffer<T> & src, const virtualbuffer<I> & ix, T* o, int s, int n) {
+    const T* base = (const T*)src.data();
+    I v[4096];
+    unsigned long long key[4096];
+    int d = prefetchdist;
+    for( int i = 0; i < n; i += 4096 ) {
+        int m = n-i < 4096 ? n-i : 4096;
+        ix.get(v, s+i, m);
+        if( base == NULL ) {
+            for( int k = 0; k < m; k++ ) o[i+k] = src[(int)v[k]];
+        } else if( gathersort > 0 && m >= gathersort ) {
+            for( int k = 0; k < m; k++ ) key[k] = (unsigned long long)(unsigned int)(int)v[k] << 32 | k;
+            std::sort(key, key+m);
+            for( int k = 0; k < m; k++ ) {
+                if( d > 0 && k+d < m ) __builtin_prefetch(base+(int)(key[k+d] >> 32));
+                o[i+(int)(key[k] & 0xffffffff)] = base[(int)(key[k] >> 32)];
+            }
+        } else {
+            for( int k = 0; k < m; k++ ) {
+                if( d > 0 && k+d < m ) __builtin_prefetch(base+(int)v[k+d]);
+                o[i+k] = base[(int)v[k]];
+            }
+        }
+    }
+}
+
 template<class T> class mapping : public map<T,int> {
 public:
     mapping(virtualbuffer<T> & m, virtualbuffer<int> & n) : map<T,int>(n), b(m) {}
     virtual T operator[](int i) const { return b[map<T,int>::a[i]]; }
+    virtual void fill(T* o, int s, int n) const {
+        gather(b, map<T,int>::a, o, s, n);
+    }
+    virtual int inputs() const { return 2; }
+    virtual simlab* input(int k) const { return k == 0 ? (simlab*)&this->a : &b; }
+    virtual void spread(int k, int & lo, int & hi) const {
+        if( k == 1 ) {
+            lo = 0;
+            hi = INT_MAX;
+        }
+    }
     virtualbuffer<T> & b;
 };
 
@@ -144,28 +815,197 @@ template<class T> class merge : public map<T,T> {
 public:
     merge(virtualbuffer<T> & m, virtualbuffer<T> & n) : map<T,T>(m), b(n) {}
     virtual T operator[](int i) const { return map<T,T>::a[b[i]]; }
+    virtual void fill(T* o, int s, int n) const {
+        gather(map<T,T>::a, b, o, s, n);
+    }
+    virtual int inputs() const { return 2; }
+    virtual simlab* input(int k) const { return k == 0 ? &this->a : &b; }
+    virtual void spread(int k, int & lo, int & hi) const {
+        if( !this->pointwise() && k == 0 ) {
+            lo = 0;
+            hi = INT_MAX;
+        }
+    }
+    bool wide() const {
+        if( wd < 0 ) wd = nodes(&this->a, forknodes) >= forknodes && nodes(&b, forknodes) >= forknodes ? 1 : 0;
+        return wd == 1;
+    }
+    /* evaluates both operands chunk by chunk, as two stealable tasks when both subtrees are big enough */
+    template<class F> void combine(T* o, int s, int n, F op) const {
+        T t[1024];
+        for( int i = 0; i < n; i += 1024 ) {
+            int m = n-i < 1024 ? n-i : 1024;
+            if( threads > 1 && wide() ) fork2([&]() { this->a.get(o+i, s+i, m); }, [&]() { b.get(t, s+i, m); });
+            else {
+                this->a.get(o+i, s+i, m);
+                b.get(t, s+i, m);
+            }
+            for( int k = 0; k < m; k++ ) o[i+k] = op(o[i+k], t[k]);
+        }
+    }
     virtualbuffer<T> & b;
+    mutable std::atomic<int> wd{-1};
 };
 
+template<class K,class T> inline void convert(K* o, const T* v, int n) {
+    for( int k = 0; k < n; k++ ) o[k] = (K)v[k];
+}
+
+inline void convert(float* o, const half* v, int n) {
+    int k = 0;
+#ifdef __F16C__
+    for( ; k+8 <= n; k += 8 ) _mm256_storeu_ps(o+k, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(v+k))));
+#endif
+    for( ; k < n; k++ ) o[k] = half::tofloat(v[k].u);
+}
+
+inline void convert(half* o, const float* v, int n) {
+    int k = 0;
+#ifdef __F16C__
+    for( ; k+8 <= n; k += 8 ) _mm_storeu_si128((__m128i*)(o+k), _mm256_cvtps_ph(_mm256_loadu_ps(v+k), _MM_FROUND_TO_NEAREST_INT));
+#endif
+    for( ; k < n; k++ ) o[k].u = half::fromfloat(v[k]);
+}
+
+inline void convert(float* o, const bhalf* v, int n) {
+    for( int k = 0; k < n; k++ ) o[k] = bitsfloat((unsigned int)v[k].u << 16);
+}
+
+inline void convert(bhalf* o, const float* v, int n) {
+    for( int k = 0; k < n; k++ ) o[k].u = bhalf::fromfloat(v[k]);
+}
+
 template<class K,class T> class cast : public map<K,T> {
 public:
     cast(virtualbuffer<T> & m) : map<K,T>(m) {}
     virtual K operator[](int i) const {
         return (K)map<K,T>::a[i];
     }
+    virtual void fill(K* o, int s, int n) const {
+        T v[1024];
+        for( int i = 0; i < n; i += 1024 ) {
+            int m = n-i < 1024 ? n-i : 1024;
+            map<K,T>::a.get(v, s+i, m);
+            convert(o+i, v, m);
+        }
+    }
+    virtual bool pointwise() const { return true; }
 };
 
-template<class K,class T> class pcast : public map<K,T> {
+/* reinterprets the bytes of the input in native order, the same as view does over materialized data */
+template<class K,class T> class reinterpret : public map<K,T> {
 public:
-    pcast(virtualbuffer<T> & m) : map<K,T>(m), d(sizeof(T)/sizeof(K)) {}
+    reinterpret(virtualbuffer<T> & m) : map<K,T>(m) {
+        simlab::length = m.length*sizeof(T)/sizeof(K);
+    }
     virtual K operator[](int i) const {
-        int k = (i*sizeof(K))/sizeof(T);
-        T t = map<K,T>::a[k];
-        return ((K*)&t)[i%d];
+        T v[sizeof(K)/sizeof(T)+2] = {};
+        long long lo = (long long)i*sizeof(K);
+        int t0 = lo/sizeof(T);
+        int t1 = (lo+sizeof(K)+sizeof(T)-1)/sizeof(T);
+        for( int t = t0; t < t1; t++ ) v[t-t0] = map<K,T>::a[t];
+        K k;
+        memcpy(&k, (const char*)v+(lo-(long long)t0*sizeof(T)), sizeof(K));
+        return k;
+    }
+    virtual void fill(K* o, int s, int n) const {
+        T v[1026];
+        int c = sizeof(K) < 1024*sizeof(T) ? 1024*sizeof(T)/sizeof(K) : 1;
+        for( int i = 0; i < n; i += c ) {
+            int m = n-i < c ? n-i : c;
+            long long lo = (long long)(s+i)*sizeof(K);
+            long long hi = lo+(long long)m*sizeof(K);
+            int t0 = lo/sizeof(T);
+            int t1 = (hi+sizeof(T)-1)/sizeof(T);
+            map<K,T>::a.get(v, t0, t1-t0);
+            memcpy(o+i, (const char*)v+(lo-(long long)t0*sizeof(T)), m*sizeof(K));
+        }
+    }
+};
+
+template<class K,class T> class pcast : public reinterpret<K,T> {
+public:
+    pcast(virtualbuffer<T> & m) : reinterpret<K,T>(m) {}
+};
+
+/* pcast has always assembled doubles from bytes and ints most significant first, pcastle and pcastbe give native and explicit order */
+template<> class pcast<double,unsigned char> : public map<double,unsigned char> {
+public:
+    pcast(virtualbuffer<unsigned char> & m) : map<double,unsigned char>(m), d(sizeof(double)/sizeof(unsigned char)) {}
+    virtual double operator[](int i) const {
+        long long l = 0;
+        for( int k = 0; k < d; k++ ) {
+            l <<= 8;
+            l |= a[d*i+k];
+        }
+        return *((double*)&l);
+    }
+    int d;
+};
+
+template<> class pcast<double,int> : public map<double,int> {
+public:
+    pcast(virtualbuffer<int> & m) : map<double,int>(m), d(sizeof(double)/sizeof(int)) {}
+    virtual double operator[](int i) const {
+        unsigned long long l = 0;
+        for( int k = 0; k < d; k++ ) {
+            l <<= (sizeof(int)*8);
+            unsigned long long v = a[d*i+k];
+            l |= v;
+        }
+        return *((double*)&l);
     }
     int d;
 };
 
+template<class K,class T> class view : public map<K,T> {
+public:
+    view(virtualbuffer<T> & m) : map<K,T>(m), p((const K*)m.data()) {
+        simlab::length = m.length*sizeof(T)/sizeof(K);
+    }
+    virtual K operator[](int i) const {
+        return p[i];
+    }
+    virtual void fill(K* o, int s, int n) const {
+        memcpy(o, p+s, n*sizeof(K));
+    }
+    virtual void* data() const { return (void*)p; }
+    const K* p;
+};
+
+template<class T> inline T swapbytes(T v) {
+    if( sizeof(T) == 2 ) {
+        unsigned short u;
+        memcpy(&u, &v, 2);
+        u = __builtin_bswap16(u);
+        memcpy((void*)&v, &u, 2);
+    } else if( sizeof(T) == 4 ) {
+        unsigned int u;
+        memcpy(&u, &v, 4);
+        u = __builtin_bswap32(u);
+        memcpy((void*)&v, &u, 4);
+    } else if( sizeof(T) == 8 ) {
+        unsigned long long u;
+        memcpy(&u, &v, 8);
+        u = __builtin_bswap64(u);
+        memcpy((void*)&v, &u, 8);
+    }
+    return v;
+}
+
+template<class T> class bswap : public map<T,T> {
+public:
+    bswap(virtualbuffer<T> & m) : map<T,T>(m) {}
+    virtual T operator[](int i) const {
+        return swapbytes(map<T,T>::a[i]);
+    }
+    virtual void fill(T* o, int s, int n) const {
+        map<T,T>::a.get(o, s, n);
+        for( int k = 0; k < n; k++ ) o[k] = swapbytes(o[k]);
+    }
+    virtual bool pointwise() const { return true; }
+};
+
 template<typename K,template<typename M,typename N> class T> simlab* subcast(int val, virtualbuffer<K> & vb) {
     if( val == 8 ) {
         return new T<unsigned char,K>(vb);
@@ -181,14 +1021,28 @@ template<typename K,template<typename M,typename N> class T> simlab* subcast(int
         return new T<int,K>(vb);
     } else if( val == 34 ) {
         return new T<float,K>(vb);
+    } else if( val == 64 ) {
+        return new T<unsigned long long,K>(vb);
+    } else if( val == 65 ) {
+        return new T<long long,K>(vb);
     } else if( val == 66 ) {
         return new T<double,K>(vb);
+    } else if( val == 18 ) {
+        return new T<half,K>(vb);
+    } else if( val == 19 ) {
+        return new T<bhalf,K>(vb);
     }
     return NULL;
 }
 
 template<template<class M,class K> class T> simlab* scast(int val, simlab* sl) {
-    if( sl->type == 16 ) {
+    if( sl->type == 8 ) {
+        virtualbuffer<unsigned char> & ucvb = *(virtualbuffer<unsigned char>*)sl;
+        return subcast<unsigned char,T>(val,ucvb);
+    } else if( sl->type == 9 ) {
+        virtualbuffer<char> & cvb = *(virtualbuffer<char>*)sl;
+        return subcast<char,T>(val,cvb);
+    } else if( sl->type == 16 ) {
         virtualbuffer<unsigned short> & usvb = *(virtualbuffer<unsigned short>*)sl;
         return subcast<unsigned short,T>(val,usvb);
     } else if( sl->type == 17 ) {
@@ -212,6 +1066,12 @@ template<template<class M,class K> class T> simlab* scast(int val, simlab* sl) {
     } else if( sl->type == 66 ) {
         virtualbuffer<double> & dvb = *(virtualbuffer<double>*)sl;
         return subcast<double,T>(val,dvb);
+    } else if( sl->type == 18 ) {
+        virtualbuffer<half> & hvb = *(virtualbuffer<half>*)sl;
+        return subcast<half,T>(val,hvb);
+    } else if( sl->type == 19 ) {
+        virtualbuffer<bhalf> & bvb = *(virtualbuffer<bhalf>*)sl;
+        return subcast<bhalf,T>(val,bvb);
     }
     return NULL;
 }
@@ -222,6 +1082,11 @@ public:
     virtual K operator[](int i) const {
         return f(map<K,T>::a[i]);
     }
+    virtual void fill(K* o, int s, int n) const {
+        K (*g)(K) = f;
+        unary(map<K,T>::a, o, s, n, [g](T v) { return g(v); });
+    }
+    virtual bool pointwise() const { return true; }
     /*virtual K& operator[](int i) {
         return map<K,T>::a[i];
     }*/
@@ -281,6 +1146,9 @@ public:
     virtual T operator[](int i) const {
         return map<T,T>::a[i+1]-map<T,T>::a[i];
     }
+    virtual void spread(int k, int & lo, int & hi) const {
+        if( lo > 0 ) lo--;
+    }
 };
 
 template<class T> class sq : public map<T,T> {
@@ -289,6 +1157,10 @@ public:
     virtual T operator[](int i) const {
         return map<T,T>::a[i]*map<T,T>::a[i];
     }
+    virtual void fill(T* o, int s, int n) const {
+        unary(map<T,T>::a, o, s, n, [](T v) { return v*v; });
+    }
+    virtual bool pointwise() const { return true; }
 };
 
 template<class T> class sl_sqrt : public arith<double,T> {
@@ -307,6 +1179,10 @@ public:
     virtual T operator[](int i) const {
         return merge<T>::a[i]+merge<T>::b[i];
     }
+    virtual void fill(T* o, int s, int n) const {
+        merge<T>::combine(o, s, n, [](T x, T y) { return x+y; });
+    }
+    virtual bool pointwise() const { return true; }
 };
 
 template<class T> class sub : public merge<T> {
@@ -315,6 +1191,10 @@ public:
     virtual T operator[](int i) const {
         return merge<T>::a[i]-merge<T>::b[i];
     }
+    virtual void fill(T* o, int s, int n) const {
+        merge<T>::combine(o, s, n, [](T x, T y) { return x-y; });
+    }
+    virtual bool pointwise() const { return true; }
 };
 
 template<class T> class mul : public merge<T> {
@@ -323,6 +1203,10 @@ public:
     virtual T operator[](int i) const {
         return merge<T>::a[i]*merge<T>::b[i];
     }
+    virtual void fill(T* o, int s, int n) const {
+        merge<T>::combine(o, s, n, [](T x, T y) { return x*y; });
+    }
+    virtual bool pointwise() const { return true; }
 };
 
 template<class T> class neg : public map<T,T> {
@@ -331,51 +1215,34 @@ public:
     virtual T operator[](int i) const {
         return -map<T,T>::a[i];
     }
+    virtual void fill(T* o, int s, int n) const {
+        unary(map<T,T>::a, o, s, n, [](T v) { return -v; });
+    }
+    virtual bool pointwise() const { return true; }
 };
 
-template<> class pcast<double,unsigned char> : public map<double,unsigned char> {
+template<class T> class divd : public merge<T> {
 public:
-    pcast(virtualbuffer<unsigned char> & m) : map<double,unsigned char>(m), d(sizeof(double)/sizeof(unsigned char)) {}
-    virtual double operator[](int i) const {
-        long long l = 0;
-        for( int k = 0; k < d; k++ ) {
-            l <<= 8;
-            l |= a[d*i+k];
-        }
-        return *((double*)&l);
+    divd(virtualbuffer<T> & m, virtualbuffer<T> & n) : merge<T>(m,n) {}
+    virtual T operator[](int i) const {
+        return merge<T>::a[i] / merge<T>::b[i];
     }
-    int d;
+    virtual void fill(T* o, int s, int n) const {
+        merge<T>::combine(o, s, n, [](T x, T y) { return x/y; });
+    }
+    virtual bool pointwise() const { return true; }
 };
 
-template<> class pcast<double,int> : public map<double,int> {
-public:
-    pcast(virtualbuffer<int> & m) : map<double,int>(m), d(sizeof(double)/sizeof(int)) {}
-    virtual double operator[](int i) const {
-        unsigned long long l = 0;
-        for( int k = 0; k < d; k++ ) {
-            l <<= (sizeof(int)*8);
-            unsigned long long v = a[d*i+k];
-            l |= v;
-        }
-        return *((double*)&l);
-    }
-    int d;
-};
-
-template<class T> class divd : public merge<T> {
-public:
-    divd(virtualbuffer<T> & m, virtualbuffer<T> & n) : merge<T>(m,n) {}
-    virtual T operator[](int i) const {
-        return merge<T>::a[i] / merge<T>::b[i];
-    }
-};
-
-template<class T> class mod : public merge<T> {
+template<class T> class mod : public merge<T> {
 public:
     mod(virtualbuffer<T> & m, virtualbuffer<T> & n) : merge<T>(m,n) {}
     virtual T operator[](int i) const {
         return merge<T>::a[i]%merge<T>::b[i];
     }
+    virtual void fill(T* o, int s, int n) const {
+        merge<T>::combine(o, s, n, [](T x, T y) { return x%y; });
+    }
+    virtual bool pointwise() const { return true; }
 };
 
 template <> class mod<float> : public merge<float> {
@@ -384,6 +1251,10 @@ public:
     virtual float operator[](int i) const {
         return fmodf(a[i],b[i]);
     }
+    virtual void fill(float* o, int s, int n) const {
+        combine(o, s, n, [](float x, float y) { return fmodf(x,y); });
+    }
+    virtual bool pointwise() const { return true; }
 };
 
 template <> class mod<double> : public merge<double> {
@@ -392,6 +1263,134 @@ public:
     virtual double operator[](int i) const {
         return fmod(a[i],b[i]);
     }
+    virtual void fill(double* o, int s, int n) const {
+        combine(o, s, n, [](double x, double y) { return fmod(x,y); });
+    }
+    virtual bool pointwise() const { return true; }
+};
+
+template <> class mod<half> : public merge<half> {
+public:
+    mod(virtualbuffer<half> & m, virtualbuffer<half> & n) : merge<half>(m,n) {}
+    virtual half operator[](int i) const {
+        return fmodf(a[i],b[i]);
+    }
+    virtual void fill(half* o, int s, int n) const {
+        combine(o, s, n, [](half x, half y) { return half(fmodf(x,y)); });
+    }
+    virtual bool pointwise() const { return true; }
+};
+
+template <> class mod<bhalf> : public merge<bhalf> {
+public:
+    mod(virtualbuffer<bhalf> & m, virtualbuffer<bhalf> & n) : merge<bhalf>(m,n) {}
+    virtual bhalf operator[](int i) const {
+        return fmodf(a[i],b[i]);
+    }
+    virtual void fill(bhalf* o, int s, int n) const {
+        combine(o, s, n, [](bhalf x, bhalf y) { return bhalf(fmodf(x,y)); });
+    }
+    virtual bool pointwise() const { return true; }
+};
+
+template<class T> class lt : public merge<T> {
+public:
+    lt(virtualbuffer<T> & m, virtualbuffer<T> & n) : merge<T>(m,n) {}
+    virtual T operator[](int i) const {
+        return (T)(merge<T>::a[i] < merge<T>::b[i]);
+    }
+    virtual void fill(T* o, int s, int n) const {
+        merge<T>::combine(o, s, n, [](T x, T y) { return (T)(x < y); });
+    }
+    virtual bool pointwise() const { return true; }
+};
+
+template<class T> class gt : public merge<T> {
+public:
+    gt(virtualbuffer<T> & m, virtualbuffer<T> & n) : merge<T>(m,n) {}
+    virtual T operator[](int i) const {
+        return (T)(merge<T>::a[i] > merge<T>::b[i]);
+    }
+    virtual void fill(T* o, int s, int n) const {
+        merge<T>::combine(o, s, n, [](T x, T y) { return (T)(x > y); });
+    }
+    virtual bool pointwise() const { return true; }
+};
+
+template<class T> class eq : public merge<T> {
+public:
+    eq(virtualbuffer<T> & m, virtualbuffer<T> & n) : merge<T>(m,n) {}
+    virtual T operator[](int i) const {
+        return (T)(merge<T>::a[i] == merge<T>::b[i]);
+    }
+    virtual void fill(T* o, int s, int n) const {
+        merge<T>::combine(o, s, n, [](T x, T y) { return (T)(x == y); });
+    }
+    virtual bool pointwise() const { return true; }
+};
+
+template<class T> class vmin : public merge<T> {
+public:
+    vmin(virtualbuffer<T> & m, virtualbuffer<T> & n) : merge<T>(m,n) {}
+    virtual T operator[](int i) const {
+        T x = merge<T>::a[i], y = merge<T>::b[i];
+        return x < y ? x : y;
+    }
+    virtual void fill(T* o, int s, int n) const {
+        merge<T>::combine(o, s, n, [](T x, T y) { return x < y ? x : y; });
+    }
+    virtual bool pointwise() const { return true; }
+};
+
+template<class T> class vmax : public merge<T> {
+public:
+    vmax(virtualbuffer<T> & m, virtualbuffer<T> & n) : merge<T>(m,n) {}
+    virtual T operator[](int i) const {
+        T x = merge<T>::a[i], y = merge<T>::b[i];
+        return x > y ? x : y;
+    }
+    virtual void fill(T* o, int s, int n) const {
+        merge<T>::combine(o, s, n, [](T x, T y) { return x > y ? x : y; });
+    }
+    virtual bool pointwise() const { return true; }
+};
+
+template<class T> class choose : public merge<T> {
+public:
+    choose(virtualbuffer<T> & m, virtualbuffer<T> & n, virtualbuffer<T> & k) : merge<T>(m,n), mask(k) {}
+    virtual T operator[](int i) const {
+        return mask[i] ? merge<T>::a[i] : merge<T>::b[i];
+    }
+    virtual void fill(T* o, int s, int n) const {
+        T k[1024], y[1024];
+        for( int i = 0; i < n; i += 1024 ) {
+            int m = n-i < 1024 ? n-i : 1024;
+            mask.get(k, s+i, m);
+            merge<T>::a.get(o+i, s+i, m);
+            merge<T>::b.get(y, s+i, m);
+            for( int j = 0; j < m; j++ ) o[i+j] = k[j] != 0 ? o[i+j] : y[j];
+        }
+    }
+    virtual int inputs() const { return 3; }
+    virtual simlab* input(int k) const { return k == 2 ? &mask : merge<T>::input(k); }
+    virtual bool pointwise() const { return true; }
+    virtualbuffer<T> & mask;
+};
+
+template<class T> class clamp : public virtualbuffer<T> {
+public:
+    clamp(virtualbuffer<T> & v, virtualbuffer<T> & lo, virtualbuffer<T> & hi) : mx(v,lo), mn(mx,hi) {}
+    virtual T operator[](int i) const {
+        return mn[i];
+    }
+    virtual void fill(T* o, int s, int n) const {
+        mn.get(o, s, n);
+    }
+    virtual int inputs() const { return 1; }
+    virtual simlab* input(int k) const { return (simlab*)&mn; }
+    virtual bool pointwise() const { return true; }
+    vmax<T> mx;
+    vmin<T> mn;
 };
 
 template<class T> class quad : public virtualbuffer<T> {
@@ -400,6 +1399,12 @@ public:
     virtual T operator[](int i) const {
         return res[i];
     }
+    virtual void fill(T* o, int s, int n) const {
+        res.get(o, s, n);
+    }
+    virtual int inputs() const { return 1; }
+    virtual simlab* input(int k) const { return (simlab*)&res; }
+    virtual bool pointwise() const { return true; }
     neg<T> nb;
     mul<T> ac;
     cnst<T> fr;
@@ -419,6 +1424,12 @@ public:
     virtual int operator[](int i) const {
         return sm[i];
     }
+    virtual void fill(int* o, int s, int n) const {
+        sm.get(o, s, n);
+    }
+    virtual int inputs() const { return 1; }
+    virtual simlab* input(int k) const { return (simlab*)&sm; }
+    virtual bool pointwise() const { return true; }
     nidx ni;
     sum<int> sm;
 };
@@ -429,6 +1440,12 @@ public:
     virtual int operator[](int i) const {
         return md[i];
     }
+    virtual void fill(int* o, int s, int n) const {
+        md.get(o, s, n);
+    }
+    virtual int inputs() const { return 1; }
+    virtual simlab* input(int k) const { return (simlab*)&md; }
+    virtual bool pointwise() const { return true; }
     idx ix;
     sum<int> sm;
     mod<int> md;
@@ -462,8 +1479,16 @@ class trans : public virtualbuffer<int> {
 public:
     trans(int c,int r) : rc(r*c), cls(c), rws(r), ml(id,cls), md(ml,rc), dv(id,rws), sm(md,dv) {}
     virtual int operator[](int i) const {
-        return sm[i];
+        return (int)((long long)i*cls[0]%rc[0]+i/rws[0]);
+    }
+    virtual void fill(int* o, int s, int n) const {
+        long long c = cls[0], n0 = rc[0];
+        int r = rws[0];
+        for( int k = 0; k < n; k++ ) o[k] = (int)((long long)(s+k)*c%n0+(s+k)/r);
     }
+    virtual int inputs() const { return 1; }
+    virtual simlab* input(int k) const { return (simlab*)&sm; }
+    virtual bool pointwise() const { return true; }
     idx id;
     cnst<int> rc;
     cnst<int> cls;
@@ -474,6 +1499,88 @@ public:
     sum<int> sm;
 };
 
+/* transposes a K x K tile, rows of the source are sc apart and rows of the output oc apart */
+template<int S> struct tkernel {
+    enum { K = 8 };
+    template<class T> static void run(const T* src, long long sc, T* o, long long oc) {
+        for( int i = 0; i < K; i++ ) for( int j = 0; j < K; j++ ) o[j*oc+i] = src[i*sc+j];
+    }
+};
+
+#ifdef __SSE2__
+template<> struct tkernel<4> {
+    enum { K = 4 };
+    template<class T> static void run(const T* src, long long sc, T* o, long long oc) {
+        __m128i a = _mm_loadu_si128((const __m128i*)src);
+        __m128i b = _mm_loadu_si128((const __m128i*)(src+sc));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src+2*sc));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src+3*sc));
+        __m128i ab0 = _mm_unpacklo_epi32(a, b), ab1 = _mm_unpackhi_epi32(a, b);
+        __m128i cd0 = _mm_unpacklo_epi32(c, d), cd1 = _mm_unpackhi_epi32(c, d);
+        _mm_storeu_si128((__m128i*)o, _mm_unpacklo_epi64(ab0, cd0));
+        _mm_storeu_si128((__m128i*)(o+oc), _mm_unpackhi_epi64(ab0, cd0));
+        _mm_storeu_si128((__m128i*)(o+2*oc), _mm_unpacklo_epi64(ab1, cd1));
+        _mm_storeu_si128((__m128i*)(o+3*oc), _mm_unpackhi_epi64(ab1, cd1));
+    }
+};
+
+template<> struct tkernel<8> {
+    enum { K = 2 };
+    template<class T> static void run(const T* src, long long sc, T* o, long long oc) {
+        __m128i a = _mm_loadu_si128((const __m128i*)src);
+        __m128i b = _mm_loadu_si128((const __m128i*)(src+sc));
+        _mm_storeu_si128((__m128i*)o, _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128((__m128i*)(o+oc), _mm_unpackhi_epi64(a, b));
+    }
+};
+#endif
+
+int transtile = 64;
+
+/* writes rows p0..p1 of the c x r transpose of the r x c matrix src, tile by tile */
+template<class T> void transposerows(const T* src, T* o, int c, int r, int p0, int p1) {
+    const int K = tkernel<sizeof(T)>::K;
+    int tb = transtile < K ? K : transtile/K*K;
+    for( int pb = p0; pb < p1; pb += tb ) for( int qb = 0; qb < r; qb += tb ) {
+        int pe = p1-pb < tb ? p1 : pb+tb, qe = r-qb < tb ? r : qb+tb;
+        int p = pb;
+        for( ; p+K <= pe; p += K ) {
+            int q = qb;
+            for( ; q+K <= qe; q += K ) tkernel<sizeof(T)>::run(src+(long long)q*c+p, c, o+(long long)(p-p0)*r+q, r);
+            for( ; q < qe; q++ ) for( int k = 0; k < K; k++ ) o[(long long)(p+k-p0)*r+q] = src[(long long)q*c+p+k];
+        }
+        for( ; p < pe; p++ ) for( int q = qb; q < qe; q++ ) o[(long long)(p-p0)*r+q] = src[(long long)q*c+p];
+    }
+}
+
+/* mapping of a materialized buffer through trans, filled by blocked transposition instead of a strided gather */
+template<class T> class transposed : public mapping<T> {
+public:
+    transposed(virtualbuffer<T> & m, trans & t) : mapping<T>(m, t), c(t.cls[0]), r(t.rws[0]) {}
+    virtual void fill(T* o, int s, int n) const {
+        const T* src = (const T*)mapping<T>::b.data();
+        long long end = (long long)s+n;
+        if( src == NULL || r <= 0 || end > (long long)c*r ) {
+            mapping<T>::fill(o, s, n);
+            return;
+        }
+        int p0 = (s+r-1)/r, p1 = (int)(end/r);
+        if( p0 >= p1 ) {
+            part(src, o, s, n);
+            return;
+        }
+        int head = p0*r-s;
+        part(src, o, s, head);
+        transposerows<T>(src, o+head, c, r, p0, p1);
+        part(src, o+head+(p1-p0)*r, p1*r, (int)(end-(long long)p1*r));
+    }
+    void part(const T* src, T* o, int s, int n) const {
+        for( int k = 0; k < n; k++ ) o[k] = src[(long long)((s+k)%r)*c+(s+k)/r];
+    }
+    int c;
+    int r;
+};
+
 class order : public virtualbuffer<int> {
 public:
     order(virtualbuffer<int> & t) : a(t) {}
@@ -482,6 +1589,8 @@ public:
         while( a[k] != i ) k++;
         return k;
     }
+    virtual int inputs() const { return 1; }
+    virtual simlab* input(int k) const { return &a; }
     virtualbuffer<int> & a;
 };
 
@@ -504,12 +1613,108 @@ template<typename T> virtualbuffer<T> & quadratic_func(virtualbuffer<T> & a, vir
     return nb;
 }
 
+extern "C" int sl_threads(int t) {
+    threads = t > 0 ? t : 1;
+    return 0;
+}
+
+extern "C" int sl_forknodes(int n) {
+    forknodes = n > 1 ? n : 1;
+    return 0;
+}
+
+int pipedepth = 8;
+int pipechunk = 1<<16;
+
+extern "C" int sl_pipeline(int depth, int chunk) {
+    pipedepth = depth > 0 ? depth : 1;
+    pipechunk = chunk > 0 ? chunk : 1;
+    return 0;
+}
+
+/* evaluator threads produce numbered chunks while a writer thread consumes them in order, at most pipedepth in flight,
+   an exception in any of them stops the others and is rethrown after they are joined */
+template<class P,class C> int pipeline(long long len, P produce, C consume) {
+    long long chunks = (len+pipechunk-1)/pipechunk;
+    int depth = pipedepth;
+    std::vector<std::vector<char> > slot(depth);
+    std::vector<long long> ready(depth, -1);
+    std::mutex m;
+    std::condition_variable cv;
+    long long next = 0;
+    long long written = 0;
+    bool failed = false;
+    std::exception_ptr error;
+
+    std::thread writer([&]() {
+        std::unique_lock<std::mutex> lk(m);
+        while( written < chunks ) {
+            cv.wait(lk, [&]() { return failed || ready[written%depth] == written; });
+            if( failed ) break;
+            long long c = written;
+            lk.unlock();
+            bool ok = false;
+            try {
+                ok = consume(slot[c%depth]);
+            } catch( ... ) {
+                lk.lock();
+                if( !error ) error = std::current_exception();
+                lk.unlock();
+            }
+            lk.lock();
+            ready[c%depth] = -1;
+            written++;
+            if( !ok ) failed = true;
+            cv.notify_all();
+            if( failed ) break;
+        }
+    });
+
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lk(m);
+        while( true ) {
+            cv.wait(lk, [&]() { return failed || next >= chunks || next < written+depth; });
+            if( failed || next >= chunks ) break;
+            long long c = next++;
+            lk.unlock();
+            std::vector<char> & out = slot[c%depth];
+            out.clear();
+            long long s = c*pipechunk;
+            try {
+                produce(s, (int)(len-s < pipechunk ? len-s : pipechunk), out);
+            } catch( ... ) {
+                lk.lock();
+                if( !error ) error = std::current_exception();
+                failed = true;
+                cv.notify_all();
+                break;
+            }
+            lk.lock();
+            ready[c%depth] = c;
+            cv.notify_all();
+        }
+    };
+    std::vector<std::thread> pool;
+    for( int k = 0; k < threads; k++ ) pool.push_back(std::thread(worker));
+    for( size_t k = 0; k < pool.size(); k++ ) pool[k].join();
+    writer.join();
+    if( error ) std::rethrow_exception(error);
+
+    return failed ? 1 : 0;
+}
+
 template<class T> int write(virtualbuffer<T> & s, int l, FILE* file) {
-    for( int i = 0; i < l; i++ ) {
-        T shrt = s[i];
-        fwrite(&shrt, sizeof(T), 1, file);
+    if( l <= pipechunk ) {
+        std::vector<T> out(l);
+        if( l > 0 ) s.fill(out.data(), 0, l);
+        return (int)fwrite(out.data(), sizeof(T), l, file) == l ? 0 : 1;
     }
-    return 0;
+    return pipeline(l, [&](long long st, int n, std::vector<char> & out) {
+        out.resize(n*sizeof(T));
+        s.fill((T*)out.data(), (int)st, n);
+    }, [&](const std::vector<char> & out) {
+        return fwrite(out.data(), 1, out.size(), file) == out.size();
+    });
 }
 
 extern "C" int sl_open(char* file) {
@@ -524,154 +1729,1710 @@ extern "C" int sl_open(char* file) {
     return system(res);
 }
 
-simlab* current;
-simlab* prev;
+/* interpreter state is per thread, a session swaps its own in while it runs a command */
+thread_local simlab* current = NULL;
+thread_local simlab* prev = NULL;
 
 extern "C" int sl_idx() {
     current = new idx();
     return 0;
 }
 
+template<template<class M> class T> simlab* sgen(int type, unsigned int seed, bool normal) {
+    if( type == 8 ) {
+        return new T<unsigned char>(seed, normal);
+    } else if( type == 9 ) {
+        return new T<char>(seed, normal);
+    } else if( type == 16 ) {
+        return new T<unsigned short>(seed, normal);
+    } else if( type == 17 ) {
+        return new T<short>(seed, normal);
+    } else if( type == 32 ) {
+        return new T<unsigned int>(seed, normal);
+    } else if( type == 33 ) {
+        return new T<int>(seed, normal);
+    } else if( type == 34 ) {
+        return new T<float>(seed, normal);
+    } else if( type == 64 ) {
+        return new T<unsigned long long>(seed, normal);
+    } else if( type == 65 ) {
+        return new T<long long>(seed, normal);
+    } else if( type == 66 ) {
+        return new T<double>(seed, normal);
+    } else if( type == 18 ) {
+        return new T<half>(seed, normal);
+    } else if( type == 19 ) {
+        return new T<bhalf>(seed, normal);
+    }
+    return NULL;
+}
+
+extern "C" int sl_rand(int seed, simlab* sl) {
+    int val = (*(virtualbuffer<int>*)sl)[0];
+    simlab* r = sgen<rnd>(val, seed, false);
+    if( r != NULL ) current = r;
+    return 0;
+}
+
+extern "C" int sl_randn(int seed, simlab* sl) {
+    int val = (*(virtualbuffer<int>*)sl)[0];
+    simlab* r = sgen<rnd>(val, seed, true);
+    if( r != NULL ) current = r;
+    return 0;
+}
+
 extern "C" int sl_cast(simlab* sl) {
     int val = (*(virtualbuffer<int>*)sl)[0];
     current = scast<cast>(val, current);
     return 0;
 }
 
+/* materialized sources are viewed in place wherever that agrees with pcast */
 extern "C" int sl_pcast(simlab* sl) {
     int val = (*(virtualbuffer<int>*)sl)[0];
-    current = scast<pcast>(val, current);
+    bool msbfirst = val == 66 && (current->type == 8 || current->type == 33);
+    if( current->data() != NULL && !msbfirst ) current = scast<view>(val, current);
+    else current = scast<pcast>(val, current);
     return 0;
 }
 
+simlab* nativecast(int val, simlab* sl) {
+    if( sl->data() != NULL ) return scast<view>(val, sl);
+    return scast<reinterpret>(val, sl);
+}
+
 extern "C" int sl_type() {
     printf("%d %d\n", current->type, current->length);
     return 0;
 }
 
+template<class T> simlab* newbuffer(int size) {
+    buffer<T>* b = new buffer<T>(size);
+    parallel(size, [&](int s, int e) { std::fill(b->buf+s, b->buf+e, T(0)); });
+    return b;
+}
+
+extern "C" int sl_hugepages(int mode) {
+    hugepages = mode;
+    return 0;
+}
+
 extern "C" int sl_buffer(int size, int type) {
-    if( type == 32 ) {
-        current = new virtualbuffer<unsigned int>(size);
+    if( type == 8 ) {
+        current = newbuffer<unsigned char>(size);
+    } else if( type == 9 ) {
+        current = newbuffer<char>(size);
+    } else if( type == 16 ) {
+        current = newbuffer<unsigned short>(size);
+    } else if( type == 17 ) {
+        current = newbuffer<short>(size);
+    } else if( type == 32 ) {
+        current = newbuffer<unsigned int>(size);
     } else if( type == 33 ) {
-        current = new virtualbuffer<int>(size);
+        current = newbuffer<int>(size);
     } else if( type == 34 ) {
-        current = new virtualbuffer<float>(size);
+        current = newbuffer<float>(size);
     } else if( type == 64 ) {
-        current = new virtualbuffer<unsigned long long>(size);
+        current = newbuffer<unsigned long long>(size);
     } else if( type == 65 ) {
-        current = new virtualbuffer<long long>(size);
+        current = newbuffer<long long>(size);
     } else if( type == 66 ) {
-        current = new virtualbuffer<double>(size);
+        current = newbuffer<double>(size);
+    } else if( type == 18 ) {
+        current = newbuffer<half>(size);
+    } else if( type == 19 ) {
+        current = newbuffer<bhalf>(size);
     }
 
     return 0;
 }
 
-template<template<class M> class T> simlab* sarith(simlab* sl) {
-    if( sl->type == 32 ) {
-        return new T<unsigned int>(*(virtualbuffer<unsigned int>*)sl);
+template<class K,class T> class lut : public map<K,T> {
+public:
+    lut(virtualbuffer<K> & f, buffer<T> & m) : map<K,T>(m), size(1<<(8*sizeof(T))) {
+        account(MEMCACHES, (long long)size*sizeof(K));
+        try {
+            std::unique_ptr<K[]> t(new K[size]);
+            scratch sd((long long)size*sizeof(T));
+            std::vector<T> dom(size);
+            for( int j = 0; j < size; j++ ) dom[j] = (T)j;
+            /* the chain reads the leaf through get, a memo of the ramp stands in for it on the tabulating thread only */
+            parallel(size, [&](int s, int e) {
+                memo ramp = {&m, 0, size, size, dom.data()};
+                memoscope ms(&ramp, 1);
+                f.fill(t.get()+s, s, e-s);
+            });
+            table = t.release();
+        } catch( ... ) {
+            account(MEMCACHES, -(long long)size*sizeof(K));
+            throw;
+        }
+    }
+    ~lut() {
+        delete[] table;
+        account(MEMCACHES, -(long long)size*sizeof(K));
+    }
+    virtual K operator[](int i) const {
+        return table[(typename std::make_unsigned<T>::type)map<K,T>::a[i]];
+    }
+    virtual void fill(K* o, int s, int n) const {
+        const K* t = table;
+        unary(map<K,T>::a, o, s, n, [t](T v) { return t[(typename std::make_unsigned<T>::type)v]; });
+    }
+    virtual bool pointwise() const { return true; }
+    int size;
+    K* table;
+};
+
+/* true when sl is a pointwise function of a single materialized 8 or 16 bit buffer, returned in leaf */
+bool unaryleaf(simlab* sl, simlab* & leaf) {
+    if( sl->data() != NULL && (sl->type == 8 || sl->type == 9 || sl->type == 16 || sl->type == 17) ) {
+        if( leaf != NULL && leaf != sl ) return false;
+        leaf = sl;
+        return true;
+    }
+    if( !sl->pointwise() ) return false;
+    for( int k = 0; k < sl->inputs(); k++ ) {
+        if( !unaryleaf(sl->input(k), leaf) ) return false;
+    }
+    return true;
+}
+
+template<class K,class T> simlab* sublut(simlab* sl, simlab* leaf) {
+    buffer<T>* b = dynamic_cast<buffer<T>*>(leaf);
+    if( b == NULL ) return NULL;
+    return new lut<K,T>(*(virtualbuffer<K>*)sl, *b);
+}
+
+template<class K> simlab* slut(simlab* sl, simlab* leaf) {
+    if( leaf->type == 8 ) {
+        return sublut<K,unsigned char>(sl, leaf);
+    } else if( leaf->type == 9 ) {
+        return sublut<K,char>(sl, leaf);
+    } else if( leaf->type == 16 ) {
+        return sublut<K,unsigned short>(sl, leaf);
+    } else if( leaf->type == 17 ) {
+        return sublut<K,short>(sl, leaf);
+    }
+    return NULL;
+}
+
+/* tabulates sl over the whole input domain when that is smaller than len (any size for len 0) */
+simlab* tlut(simlab* sl, int len) {
+    simlab* leaf = NULL;
+    if( !unaryleaf(sl, leaf) || leaf == NULL || leaf == sl ) return NULL;
+    if( len > 0 && len <= (leaf->type < 16 ? 256 : 65536) ) return NULL;
+    if( sl->type == 8 ) {
+        return slut<unsigned char>(sl, leaf);
+    } else if( sl->type == 9 ) {
+        return slut<char>(sl, leaf);
+    } else if( sl->type == 16 ) {
+        return slut<unsigned short>(sl, leaf);
+    } else if( sl->type == 17 ) {
+        return slut<short>(sl, leaf);
+    } else if( sl->type == 32 ) {
+        return slut<unsigned int>(sl, leaf);
     } else if( sl->type == 33 ) {
-        return new T<int>(*(virtualbuffer<int>*)sl);
+        return slut<int>(sl, leaf);
     } else if( sl->type == 34 ) {
-        return new T<float>(*(virtualbuffer<float>*)sl);
+        return slut<float>(sl, leaf);
     } else if( sl->type == 64 ) {
-        return new T<unsigned long long>(*(virtualbuffer<unsigned long long>*)sl);
+        return slut<unsigned long long>(sl, leaf);
     } else if( sl->type == 65 ) {
-        return new T<long long>(*(virtualbuffer<long long>*)sl);
+        return slut<long long>(sl, leaf);
     } else if( sl->type == 66 ) {
-        return new T<double>(*(virtualbuffer<double>*)sl);
+        return slut<double>(sl, leaf);
     }
     return NULL;
 }
 
-extern "C" int sl_cosf() {
-    current = sarith<slc_cosf>(current);
-    return 0;
-}
-
-extern "C" int sl_cos() {
-    current = sarith<slc_cos>(current);
-    return 0;
-}
-
-extern "C" int sl_sinf() {
-    current = sarith<slc_sinf>(current);
+extern "C" int sl_lut() {
+    simlab* l = tlut(current, 0);
+    if( l == NULL ) {
+        printf("lut needs a pointwise chain over one 8 or 16 bit buffer\n");
+        return 1;
+    }
+    current = l;
     return 0;
 }
 
-extern "C" int sl_sin() {
-    current = sarith<slc_sin>(current);
-    return 0;
-}
+typedef std::vector<std::pair<int,int> > ranges;
 
-extern "C" int sl_logf() {
-    current = sarith<slc_logf>(current);
-    return 0;
+void unite(ranges & r) {
+    std::sort(r.begin(), r.end());
+    size_t w = 0;
+    for( size_t k = 0; k < r.size(); k++ ) {
+        if( w > 0 && r[k].first <= r[w-1].second ) r[w-1].second = std::max(r[w-1].second, r[k].second);
+        else r[w++] = r[k];
+    }
+    r.resize(w);
 }
 
-extern "C" int sl_log() {
-    current = sarith<slc_log>(current);
-    return 0;
-}
+class incremental {
+public:
+    virtual ~incremental() {}
+    virtual int refresh() = 0;
+};
 
-extern "C" int sl_floorf() {
-    current = sarith<slc_floorf>(current);
-    return 0;
+/* output ranges of sl that changed since the edit counts in seen, tracked buffers are the leaves */
+ranges changed(const simlab* sl, const std::map<const simlab*,size_t> & seen) {
+    ranges r;
+    std::shared_ptr<editlog> e = sl->edits();
+    if( e ) {
+        std::map<const simlab*,size_t>::const_iterator it = seen.find(sl);
+        e->since(it == seen.end() ? 0 : it->second, r);
+    } else {
+        for( int k = 0; k < sl->inputs(); k++ ) {
+            ranges c = changed(sl->input(k), seen);
+            for( size_t j = 0; j < c.size(); j++ ) {
+                int lo = c[j].first, hi = c[j].second;
+                sl->spread(k, lo, hi);
+                r.push_back(std::make_pair(lo < 0 ? 0 : lo, hi));
+            }
+        }
+    }
+    unite(r);
+    return r;
 }
 
-extern "C" int sl_floor() {
-    current = sarith<slc_floor>(current);
-    return 0;
+/* brings materialized inputs up to date first, then records how far each tracked leaf has been seen */
+void snapshot(const simlab* sl, std::map<const simlab*,size_t> & seen, bool update) {
+    std::shared_ptr<editlog> e = sl->edits();
+    if( e ) {
+        incremental* d = dynamic_cast<incremental*>((simlab*)sl);
+        if( update && d != NULL ) d->refresh();
+        seen[sl] = e->count();
+        return;
+    }
+    for( int k = 0; k < sl->inputs(); k++ ) snapshot(sl->input(k), seen, update);
 }
 
-/*template<class T> int tsl_add(virtualbuffer<T>* a, simlab* b) {
-    if( b->type == 32 ) {
-        current = new sum<T,unsigned int>(*a, *b);
-    } else if( b->type == 33 ) {
-        current = new sum<T,unsigned int>(*a, *b);
+/* materialized result that remembers its expression and recomputes only the ranges its tracked inputs changed,
+   it holds the logs of its leaves so they keep the entries it has not seen yet and outlive the leaves */
+template<class T> class derived : public buffer<T>, public incremental {
+public:
+    derived(virtualbuffer<T> & e, int len) : buffer<T>(len), expr(e) {
+        snapshot(&expr, seen, false);
+        hold(seen);
     }
-
-    return 0;
-}*/
-
-template<typename K,template<class M> class T> simlab* submarith(virtualbuffer<K> & sl, simlab* b) {
-    if( sl.type == b->type ) return new T<K>(sl, *(virtualbuffer<K>*)b);
-    else {
-        virtualbuffer<K> & vk = *(virtualbuffer<K>*)scast<cast>(sl.type,b);
-        return new T<K>(sl, vk);
+    ~derived() {
+        release(seen);
     }
-    /*if( b->type == 32 ) {
-        return new T<K>(sl, *(virtualbuffer<unsigned int>*)b);
-    } else if( b->type == 66 ) {
-        return new T<K>(sl, *(virtualbuffer<double>*)b);
-    }*/
-    return NULL;
+    void hold(const std::map<const simlab*,size_t> & at) {
+        for( std::map<const simlab*,size_t>::const_iterator it = at.begin(); it != at.end(); it++ ) {
+            std::shared_ptr<editlog> & l = logs[it->first];
+            if( !l ) l = it->first->edits();
+            l->hold(it->second);
+        }
+    }
+    void release(const std::map<const simlab*,size_t> & at) {
+        for( std::map<const simlab*,size_t>::const_iterator it = at.begin(); it != at.end(); it++ ) logs[it->first]->release(it->second);
+    }
+    virtual int refresh() {
+        std::map<const simlab*,size_t> now;
+        snapshot(&expr, now, true);
+        ranges r = changed(&expr, seen);
+        int len = simlab::length, done = 0;
+        for( size_t k = 0; k < r.size(); k++ ) {
+            int lo = r[k].first, hi = r[k].second < len ? r[k].second : len;
+            if( lo >= hi ) continue;
+            T* b = buffer<T>::buf;
+            parallel(hi-lo, [&](int s, int e) { expr.fill(b+lo+s, lo+s, e-s); });
+            buffer<T>::touched(lo, hi);
+            done += hi-lo;
+        }
+        hold(now);
+        release(seen);
+        seen = now;
+        return done;
+    }
+    virtualbuffer<T> & expr;
+    std::map<const simlab*,size_t> seen;
+    std::map<const simlab*,std::shared_ptr<editlog> > logs;
+};
+
+template<class T> simlab* materialize(virtualbuffer<T> & vb, int len, simlab* track = NULL) {
+    derived<T>* b = new derived<T>(*(virtualbuffer<T>*)(track != NULL ? track : &vb), len);
+    parallel(len, [&](int s, int e) { vb.fill(b->buf+s, s, e-s); });
+    return b;
 }
 
-template<template<class M> class T> simlab* marith(simlab* sl, simlab* b) {
-    if( sl->type == 32 ) {
-        return submarith<unsigned int,T>(*(virtualbuffer<unsigned int>*)sl, b);
+simlab* tmaterialize(simlab* sl, int len, simlab* track = NULL) {
+    if( sl->type == 8 ) {
+        return materialize<unsigned char>(*(virtualbuffer<unsigned char>*)sl, len, track);
+    } else if( sl->type == 9 ) {
+        return materialize<char>(*(virtualbuffer<char>*)sl, len, track);
+    } else if( sl->type == 16 ) {
+        return materialize<unsigned short>(*(virtualbuffer<unsigned short>*)sl, len, track);
+    } else if( sl->type == 17 ) {
+        return materialize<short>(*(virtualbuffer<short>*)sl, len, track);
+    } else if( sl->type == 32 ) {
+        return materialize<unsigned int>(*(virtualbuffer<unsigned int>*)sl, len, track);
     } else if( sl->type == 33 ) {
-        return submarith<int,T>(*(virtualbuffer<int>*)sl, b);
+        return materialize<int>(*(virtualbuffer<int>*)sl, len, track);
     } else if( sl->type == 34 ) {
-        return submarith<float,T>(*(virtualbuffer<float>*)sl, b);
+        return materialize<float>(*(virtualbuffer<float>*)sl, len, track);
+    } else if( sl->type == 64 ) {
+        return materialize<unsigned long long>(*(virtualbuffer<unsigned long long>*)sl, len, track);
+    } else if( sl->type == 65 ) {
+        return materialize<long long>(*(virtualbuffer<long long>*)sl, len, track);
+    } else if( sl->type == 66 ) {
+        return materialize<double>(*(virtualbuffer<double>*)sl, len, track);
+    } else if( sl->type == 18 ) {
+        return materialize<half>(*(virtualbuffer<half>*)sl, len, track);
+    } else if( sl->type == 19 ) {
+        return materialize<bhalf>(*(virtualbuffer<bhalf>*)sl, len, track);
     }
     return NULL;
 }
 
-extern "C" int sl_neg() {
-    if( current->type == 32 ) {
-        current = new neg<unsigned int>(*(virtualbuffer<unsigned int>*)current);
-    } else if( current->type == 33 ) {
-        current = new neg<int>(*(virtualbuffer<int>*)current);
-    } else if( current->type == 34 ) {
-        current = new neg<float>(*(virtualbuffer<float>*)current);
-    }
+extern "C" int sl_materialize(int len) {
+    simlab* l = tlut(current, len);
+    simlab* m = tmaterialize(l != NULL ? l : current, len, current);
+    if( l != NULL ) delete l;
+    if( m != NULL ) current = m;
     return 0;
 }
 
-extern "C" int sl_div(simlab* b) {
-    current = marith<divd>(current, b);
+template<class T> void setvalue(simlab* sl, int i, double v) {
+    ((virtualbuffer<T>*)sl)->operator()(i, (T)v);
+}
+
+extern "C" int sl_set(int i, simlab* v) {
+    if( !current->edits() || i < 0 || i >= current->length ) {
+        printf("set needs a buffer and an index inside it\n");
+        return 1;
+    }
+    double d = (*(virtualbuffer<double>*)scast<cast>(66, v))[0];
+    if( current->type == 8 ) {
+        setvalue<unsigned char>(current, i, d);
+    } else if( current->type == 9 ) {
+        setvalue<char>(current, i, d);
+    } else if( current->type == 16 ) {
+        setvalue<unsigned short>(current, i, d);
+    } else if( current->type == 17 ) {
+        setvalue<short>(current, i, d);
+    } else if( current->type == 32 ) {
+        setvalue<unsigned int>(current, i, d);
+    } else if( current->type == 33 ) {
+        setvalue<int>(current, i, d);
+    } else if( current->type == 34 ) {
+        setvalue<float>(current, i, d);
+    } else if( current->type == 64 ) {
+        setvalue<unsigned long long>(current, i, d);
+    } else if( current->type == 65 ) {
+        setvalue<long long>(current, i, d);
+    } else if( current->type == 66 ) {
+        setvalue<double>(current, i, d);
+    } else if( current->type == 18 ) {
+        setvalue<half>(current, i, d);
+    } else if( current->type == 19 ) {
+        setvalue<bhalf>(current, i, d);
+    }
+    return 0;
+}
+
+extern "C" int sl_refresh() {
+    incremental* d = dynamic_cast<incremental*>(current);
+    if( d == NULL ) {
+        printf("refresh needs a materialized result\n");
+        return 1;
+    }
+    printf("recomputed %d of %d\n", d->refresh(), current->length);
+    return 0;
+}
+
+/* unpacks 128 b bit offsets stored in four interleaved lanes, the lanes share their shifts */
+template<int b> void unpackbits(const unsigned int* d, unsigned int* o) {
+    if( b == 0 ) {
+        for( int j = 0; j < 128; j++ ) o[j] = 0;
+        return;
+    }
+    const unsigned int mask = b == 32 ? 0xffffffffu : (1u << (b & 31))-1;
+#ifdef __SSE2__
+    const __m128i m = _mm_set1_epi32(mask);
+    for( int t = 0; t < 32; t++ ) {
+        int bit = t*b, x = bit >> 5, sh = bit & 31;
+        __m128i v = _mm_srl_epi32(_mm_loadu_si128((const __m128i*)(d+4*x)), _mm_cvtsi32_si128(sh));
+        if( sh+b > 32 ) v = _mm_or_si128(v, _mm_sll_epi32(_mm_loadu_si128((const __m128i*)(d+4*x+4)), _mm_cvtsi32_si128(32-sh)));
+        _mm_storeu_si128((__m128i*)(o+4*t), _mm_and_si128(v, m));
+    }
+#else
+    for( int t = 0; t < 32; t++ ) {
+        int bit = t*b, x = bit >> 5, sh = bit & 31;
+        if( sh+b > 32 ) {
+            for( int l = 0; l < 4; l++ ) o[4*t+l] = ((d[4*x+l] >> sh) | (d[4*(x+1)+l] << ((32-sh) & 31))) & mask;
+        } else {
+            for( int l = 0; l < 4; l++ ) o[4*t+l] = (d[4*x+l] >> sh) & mask;
+        }
+    }
+#endif
+}
+
+void (*const unpackers[33])(const unsigned int*, unsigned int*) = {
+    unpackbits<0>, unpackbits<1>, unpackbits<2>, unpackbits<3>, unpackbits<4>, unpackbits<5>, unpackbits<6>, unpackbits<7>, unpackbits<8>,
+    unpackbits<9>, unpackbits<10>, unpackbits<11>, unpackbits<12>, unpackbits<13>, unpackbits<14>, unpackbits<15>, unpackbits<16>,
+    unpackbits<17>, unpackbits<18>, unpackbits<19>, unpackbits<20>, unpackbits<21>, unpackbits<22>, unpackbits<23>, unpackbits<24>,
+    unpackbits<25>, unpackbits<26>, unpackbits<27>, unpackbits<28>, unpackbits<29>, unpackbits<30>, unpackbits<31>, unpackbits<32>
+};
+
+/* integer buffer stored in blocks of 128 values as bit packed offsets from a frame of reference, or from the previous value */
+template<class T> class packed : public virtualbuffer<T> {
+public:
+    typedef typename std::make_unsigned<T>::type U;
+    typedef typename std::make_signed<T>::type S;
+    enum { B = 128 };
+    struct block {
+        T base;
+        T ref;
+        unsigned int off;
+        unsigned char bits;
+        unsigned char mode;
+    };
+    packed(virtualbuffer<T> & vb, int len) : virtualbuffer<T>(vb.type, len) {
+        int nb = (len+B-1)/B;
+        blocks.resize(nb);
+        std::vector<std::vector<unsigned int> > part(threads > 0 ? threads : 1);
+        std::vector<int> first(part.size()+1, nb);
+        std::atomic<int> slot(0);
+        parallel(nb, [&](int s, int e) {
+            int p = slot++;
+            first[p] = s;
+            std::vector<unsigned int> & w = part[p];
+            T v[B];
+            for( int k = s; k < e; k++ ) {
+                int n = len-k*B < B ? len-k*B : B;
+                vb.fill(v, k*B, n);
+                for( int j = n; j < B; j++ ) v[j] = v[n-1];
+                blocks[k].off = w.size();
+                encode(v, blocks[k], w);
+            }
+        });
+        std::vector<int> order;
+        for( int p = 0; p < slot; p++ ) order.push_back(p);
+        std::sort(order.begin(), order.end(), [&](int x, int y) { return first[x] < first[y]; });
+        for( size_t q = 0; q < order.size(); q++ ) {
+            int p = order[q];
+            int e = q+1 < order.size() ? first[order[q+1]] : nb;
+            unsigned int shift = words.size();
+            for( int k = first[p]; k < e; k++ ) blocks[k].off += shift;
+            words.insert(words.end(), part[p].begin(), part[p].end());
+        }
+        account(MEMCACHES, bytes());
+        held = bytes();
+    }
+    ~packed() {
+        account(MEMCACHES, -held);
+    }
+    /* offsets are packed in four interleaved lanes so the lanes unpack with the same shifts */
+    static void pack(const unsigned int* o, int b, std::vector<unsigned int> & w) {
+        size_t at = w.size();
+        w.resize(at+4*b, 0);
+        if( b == 0 ) return;
+        unsigned int* d = &w[at];
+        for( int t = 0; t < B/4; t++ ) {
+            int bit = t*b, x = bit >> 5, sh = bit & 31;
+            for( int l = 0; l < 4; l++ ) {
+                unsigned int v = o[4*t+l];
+                d[4*x+l] |= v << sh;
+                if( sh+b > 32 ) d[4*(x+1)+l] |= v >> (32-sh);
+            }
+        }
+    }
+    static void unpack(const unsigned int* d, int b, unsigned int* o) {
+        unpackers[b](d, o);
+    }
+    static unsigned int field(const unsigned int* d, int b, int j) {
+        if( b == 0 ) return 0;
+        int t = j >> 2, l = j & 3, bit = t*b, x = bit >> 5, sh = bit & 31;
+        unsigned long long v = d[4*x+l] >> sh;
+        if( sh+b > 32 ) v |= (unsigned long long)d[4*(x+1)+l] << (32-sh);
+        return b == 32 ? (unsigned int)v : (unsigned int)v & ((1u << b)-1);
+    }
+    static int width(unsigned long long r) {
+        int b = 0;
+        while( b < 64 && (r >> b) != 0 ) b++;
+        return b;
+    }
+    static void encode(const T* v, block & h, std::vector<unsigned int> & w) {
+        T lo = v[0], hi = v[0];
+        S dlo = 0, dhi = 0;
+        for( int j = 1; j < B; j++ ) {
+            if( v[j] < lo ) lo = v[j];
+            if( v[j] > hi ) hi = v[j];
+            S d = (S)(U)((U)v[j]-(U)v[j-1]);
+            if( j == 1 || d < dlo ) dlo = d;
+            if( j == 1 || d > dhi ) dhi = d;
+        }
+        int fb = width((unsigned long long)(U)((U)hi-(U)lo));
+        int db = width((unsigned long long)(U)((U)dhi-(U)dlo));
+        unsigned int o[B];
+        h.base = v[0];
+        if( fb > 32 && db > 32 ) {
+            h.mode = 2;
+            h.bits = 8*sizeof(T);
+            size_t at = w.size();
+            w.resize(at+(B*sizeof(T)+3)/4);
+            memcpy(&w[at], v, B*sizeof(T));
+        } else if( fb <= db ) {
+            h.mode = 0;
+            h.bits = fb;
+            h.ref = lo;
+            for( int j = 0; j < B; j++ ) o[j] = (unsigned int)(U)((U)v[j]-(U)lo);
+            pack(o, fb, w);
+        } else {
+            h.mode = 1;
+            h.bits = db;
+            h.ref = (T)dlo;
+            o[0] = 0;
+            for( int j = 1; j < B; j++ ) o[j] = (unsigned int)(U)((U)v[j]-(U)v[j-1]-(U)dlo);
+            pack(o, db, w);
+        }
+    }
+    void decode(int k, T* v) const {
+        const block & h = blocks[k];
+        const unsigned int* d = words.data()+h.off;
+        if( h.mode == 2 ) {
+            memcpy(v, d, B*sizeof(T));
+            return;
+        }
+        unsigned int o[B];
+        unpack(d, h.bits, o);
+        U r = (U)h.ref;
+        if( h.mode == 0 ) {
+            for( int j = 0; j < B; j++ ) v[j] = (T)(U)(r+(U)o[j]);
+        } else {
+            U acc = (U)h.base;
+            v[0] = h.base;
+            for( int j = 1; j < B; j++ ) {
+                acc = (U)(acc+r+(U)o[j]);
+                v[j] = (T)acc;
+            }
+        }
+    }
+    virtual T operator[](int i) const {
+        const block & h = blocks[i/B];
+        const unsigned int* d = words.data()+h.off;
+        int j = i%B;
+        if( h.mode == 0 ) return (T)(U)((U)h.ref+(U)field(d, h.bits, j));
+        if( h.mode == 2 ) {
+            T t;
+            memcpy(&t, (const char*)d+j*sizeof(T), sizeof(T));
+            return t;
+        }
+        U acc = (U)h.base;
+        for( int q = 1; q <= j; q++ ) acc = (U)(acc+(U)h.ref+(U)field(d, h.bits, q));
+        return (T)acc;
+    }
+    virtual void fill(T* o, int s, int n) const {
+        T v[B];
+        while( n > 0 ) {
+            int k = s/B, j = s%B;
+            int m = B-j < n ? B-j : n;
+            if( j == 0 && m == B ) decode(k, o);
+            else {
+                decode(k, v);
+                memcpy(o, v+j, m*sizeof(T));
+            }
+            o += m;
+            s += m;
+            n -= m;
+        }
+    }
+    long long bytes() const {
+        return (long long)words.size()*sizeof(unsigned int)+(long long)blocks.size()*sizeof(block);
+    }
+    std::vector<block> blocks;
+    std::vector<unsigned int> words;
+    long long held;
+};
+
+template<class T> simlab* subpacked(simlab* sl, int len) {
+    packed<T>* p = new packed<T>(*(virtualbuffer<T>*)sl, len);
+    printf("packed %lld bytes into %lld\n", (long long)len*sizeof(T), p->bytes());
+    return p;
+}
+
+extern "C" int sl_compress(int len) {
+    if( len <= 0 ) {
+        printf("compress needs a length\n");
+        return 1;
+    }
+    if( current->type == 8 ) {
+        current = subpacked<unsigned char>(current, len);
+    } else if( current->type == 9 ) {
+        current = subpacked<char>(current, len);
+    } else if( current->type == 16 ) {
+        current = subpacked<unsigned short>(current, len);
+    } else if( current->type == 17 ) {
+        current = subpacked<short>(current, len);
+    } else if( current->type == 32 ) {
+        current = subpacked<unsigned int>(current, len);
+    } else if( current->type == 33 ) {
+        current = subpacked<int>(current, len);
+    } else if( current->type == 64 ) {
+        current = subpacked<unsigned long long>(current, len);
+    } else if( current->type == 65 ) {
+        current = subpacked<long long>(current, len);
+    } else {
+        printf("compress supports integer types\n");
+        return 1;
+    }
+    return 0;
+}
+
+extern "C" int sl_trans(int c, int r) {
+    current = new trans(c, r);
+    return 0;
+}
+
+template<class T> simlab* submapping(simlab* sl, virtualbuffer<int> & ix) {
+    trans* t = dynamic_cast<trans*>(&ix);
+    if( t != NULL && sl->data() != NULL ) return new transposed<T>(*(virtualbuffer<T>*)sl, *t);
+    return new mapping<T>(*(virtualbuffer<T>*)sl, ix);
+}
+
+extern "C" int sl_mapping(simlab* ix) {
+    virtualbuffer<int> & vi = *(virtualbuffer<int>*)(ix->type == 33 ? ix : scast<cast>(33, ix));
+    if( current->type == 8 ) {
+        current = submapping<unsigned char>(current, vi);
+    } else if( current->type == 9 ) {
+        current = submapping<char>(current, vi);
+    } else if( current->type == 16 ) {
+        current = submapping<unsigned short>(current, vi);
+    } else if( current->type == 17 ) {
+        current = submapping<short>(current, vi);
+    } else if( current->type == 32 ) {
+        current = submapping<unsigned int>(current, vi);
+    } else if( current->type == 33 ) {
+        current = submapping<int>(current, vi);
+    } else if( current->type == 34 ) {
+        current = submapping<float>(current, vi);
+    } else if( current->type == 64 ) {
+        current = submapping<unsigned long long>(current, vi);
+    } else if( current->type == 65 ) {
+        current = submapping<long long>(current, vi);
+    } else if( current->type == 66 ) {
+        current = submapping<double>(current, vi);
+    } else if( current->type == 18 ) {
+        current = submapping<half>(current, vi);
+    } else if( current->type == 19 ) {
+        current = submapping<bhalf>(current, vi);
+    }
+    return 0;
+}
+
+extern "C" int sl_transtile(int tile) {
+    transtile = tile;
+    return 0;
+}
+
+extern "C" int sl_prefetch(int dist, int sort) {
+    prefetchdist = dist;
+    gathersort = sort;
+    return 0;
+}
+
+double gathertime(virtualbuffer<float> & g, int n, float* out, bool block) {
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    if( block ) parallel(n, [&](int s, int e) { g.fill(out+s, s, e-s); });
+    else parallel(n, [&](int s, int e) { for( int i = s; i < e; i++ ) out[i] = g[i]; });
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+}
+
+extern "C" int sl_gatherbench(int n) {
+    int c = (int)sqrt((double)n);
+    n = c*c;
+    rnd<float> src(1, false);
+    buffer<float>* data = (buffer<float>*)materialize<float>(src, n);
+    buffer<int> random(n), strided(n);
+    rnd<unsigned int> r(2, false);
+    r.fill((unsigned int*)random.buf, 0, n);
+    for( int i = 0; i < n; i++ ) {
+        random.buf[i] = (unsigned int)random.buf[i] % n;
+        strided.buf[i] = (int)(((long long)i*4099) % n);
+    }
+    trans tr(c, c);
+    virtualbuffer<int>* pattern[] = {&random, &strided, &tr};
+    const char* name[] = {"random", "strided", "transposed"};
+    std::vector<float> out(n);
+    int dist = prefetchdist, sort = gathersort;
+    printf("%d floats\tscalar\tblock\tprefetch\tsorted\n", n);
+    for( int p = 0; p < 3; p++ ) {
+        mapping<float> g(*data, *pattern[p]);
+        double t[4];
+        t[0] = gathertime(g, n, &out[0], false);
+        prefetchdist = 0;
+        gathersort = 0;
+        t[1] = gathertime(g, n, &out[0], true);
+        prefetchdist = dist > 0 ? dist : 16;
+        t[2] = gathertime(g, n, &out[0], true);
+        gathersort = 1024;
+        t[3] = gathertime(g, n, &out[0], true);
+        printf("%s\t%f\t%f\t%f\t%f\n", name[p], t[0], t[1], t[2], t[3]);
+    }
+    prefetchdist = dist;
+    gathersort = sort;
+    delete data;
+
+    return 0;
+}
+
+template<class R> class fftplan {
+public:
+    typedef std::complex<R> C;
+    fftplan(int size) : n(size), m(0), tw(size) {
+        for( int k = 0; k < n; k++ ) tw[k] = std::polar((R)1, (R)(-2*M_PI*k/n));
+        int r = n;
+        for( int p = 2; r > 1; ) {
+            if( r%p == 0 ) {
+                factors.push_back(p);
+                r /= p;
+            } else if( p*p > r ) {
+                factors.push_back(r);
+                r = 1;
+            } else p++;
+        }
+        if( !factors.empty() && factors.back() > 13 ) {
+            m = 1;
+            while( m < 2*n-1 ) m <<= 1;
+            chirp.resize(n);
+            for( long long k = 0; k < n; k++ ) chirp[k] = std::polar((R)1, (R)(-M_PI*((k*k)%(2*n))/n));
+            std::vector<C> b(m);
+            b[0] = std::conj(chirp[0]);
+            for( int k = 1; k < n; k++ ) b[k] = b[m-k] = std::conj(chirp[k]);
+            filter.resize(m);
+            plan(m).run(&b[0], &filter[0], false);
+        }
+    }
+    static fftplan<R> & plan(int n);
+    long long bytes() const {
+        return sizeof(*this)+(long long)(tw.size()+chirp.size()+filter.size())*sizeof(C)+(long long)factors.size()*sizeof(int);
+    }
+    void run(const C* in, C* out, bool inverse) const {
+        if( m == 0 ) rec(in, out, n, 1, 0, 1, inverse);
+        else bluestein(in, out, inverse);
+    }
+    void rec(const C* in, C* out, int len, int stride, int fi, int ts, bool inv) const {
+        if( len == 1 ) {
+            out[0] = in[0];
+            return;
+        }
+        int p = factors[fi];
+        int sub = len/p;
+        bool par = len >= (1<<15) && threads > 1;
+        if( par ) parallel(p, [&](int s, int e) {
+            for( int q = s; q < e; q++ ) rec(in+q*stride, out+q*sub, sub, stride*p, fi+1, ts*p, inv);
+        });
+        else for( int q = 0; q < p; q++ ) rec(in+q*stride, out+q*sub, sub, stride*p, fi+1, ts*p, inv);
+        auto butterfly = [&](int s, int e) {
+            C t[64];
+            C* x = p <= 64 ? t : new C[p];
+            for( int k = s; k < e; k++ ) {
+                for( int q = 0; q < p; q++ ) {
+                    C w = tw[(long long)q*k*ts%n];
+                    x[q] = out[q*sub+k]*(inv ? std::conj(w) : w);
+                }
+                if( p == 2 ) {
+                    out[k] = x[0]+x[1];
+                    out[sub+k] = x[0]-x[1];
+                } else for( int r = 0; r < p; r++ ) {
+                    C acc = x[0];
+                    for( int q = 1; q < p; q++ ) {
+                        C w = tw[(long long)q*r*sub*ts%n];
+                        acc += x[q]*(inv ? std::conj(w) : w);
+                    }
+                    out[r*sub+k] = acc;
+                }
+            }
+            if( x != t ) delete[] x;
+        };
+        if( par ) parallel(sub, butterfly);
+        else butterfly(0, sub);
+    }
+    void bluestein(const C* in, C* out, bool inv) const {
+        std::vector<C> a(m), c(m);
+        for( int k = 0; k < n; k++ ) a[k] = in[k]*(inv ? std::conj(chirp[k]) : chirp[k]);
+        fftplan<R> & pm = plan(m);
+        pm.run(&a[0], &c[0], false);
+        for( int k = 0; k < m; k++ ) c[k] *= inv ? std::conj(filter[(m-k)%m]) : filter[k];
+        pm.run(&c[0], &a[0], true);
+        for( int k = 0; k < n; k++ ) out[k] = a[k]*(inv ? std::conj(chirp[k]) : chirp[k])/(R)m;
+    }
+    int n;
+    int m;
+    std::vector<C> tw;
+    std::vector<int> factors;
+    std::vector<C> chirp;
+    std::vector<C> filter;
+};
+
+std::map<std::pair<int,int>,void*> fftplans;
+std::recursive_mutex fftplanm;
+
+template<class R> fftplan<R> & fftplan<R>::plan(int n) {
+    std::lock_guard<std::recursive_mutex> lk(fftplanm);
+    std::pair<int,int> key(n, sizeof(R) == 4 ? 34 : 66);
+    std::map<std::pair<int,int>,void*>::iterator it = fftplans.find(key);
+    if( it != fftplans.end() ) return *(fftplan<R>*)it->second;
+    fftplan<R>* p = new fftplan<R>(n);
+    try {
+        account(MEMCACHES, p->bytes());
+    } catch( std::bad_alloc & ) {
+        delete p;
+        throw;
+    }
+    fftplans[key] = p;
+    return *p;
+}
+
+/* complex data is stored interleaved, re/im, in a float or double buffer */
+template<class R> simlab* fft(simlab* sl, int n, bool complex, bool inverse, bool real) {
+    int code = sizeof(R) == 4 ? 34 : 66;
+    simlab* src = sl->type == code ? sl : scast<cast>(code, sl);
+    virtualbuffer<R> & vb = *(virtualbuffer<R>*)src;
+    std::vector<std::complex<R> > in(n), out(n);
+    if( complex ) vb.fill((R*)&in[0], 0, 2*n);
+    else {
+        std::vector<R> re(n);
+        parallel(n, [&](int s, int e) { vb.fill(&re[s], s, e-s); });
+        for( int k = 0; k < n; k++ ) in[k] = re[k];
+    }
+    fftplan<R>::plan(n).run(&in[0], &out[0], inverse);
+    buffer<R>* res = new buffer<R>(real ? n : 2*n);
+    for( int k = 0; k < n; k++ ) {
+        std::complex<R> v = inverse ? out[k]/(R)n : out[k];
+        if( real ) res->buf[k] = v.real();
+        else {
+            res->buf[2*k] = v.real();
+            res->buf[2*k+1] = v.imag();
+        }
+    }
+    return res;
+}
+
+simlab* tfft(simlab* sl, int n, bool complex, bool inverse, bool real) {
+    if( sl->type == 34 ) return fft<float>(sl, n, complex, inverse, real);
+    return fft<double>(sl, n, complex, inverse, real);
+}
+
+int runfft(int n, bool complex, bool inverse, bool real) {
+    if( n <= 0 ) {
+        printf("fft needs a positive transform length\n");
+        return 1;
+    }
+    current = tfft(current, n, complex, inverse, real);
+    return 0;
+}
+
+extern "C" int sl_fft(int n) {
+    return runfft(n, false, false, false);
+}
+
+extern "C" int sl_cfft(int n) {
+    return runfft(n, true, false, false);
+}
+
+extern "C" int sl_ifft(int n) {
+    return runfft(n, true, true, false);
+}
+
+extern "C" int sl_irfft(int n) {
+    return runfft(n, true, true, true);
+}
+
+template<class T> class cmag : public map<T,T> {
+public:
+    cmag(virtualbuffer<T> & m) : map<T,T>(m) {}
+    virtual T operator[](int i) const {
+        return hypot(map<T,T>::a[2*i], map<T,T>::a[2*i+1]);
+    }
+    virtual void fill(T* o, int s, int n) const {
+        T v[2048];
+        for( int i = 0; i < n; i += 1024 ) {
+            int m = n-i < 1024 ? n-i : 1024;
+            map<T,T>::a.get(v, 2*(s+i), 2*m);
+            for( int k = 0; k < m; k++ ) o[i+k] = sqrt(v[2*k]*v[2*k]+v[2*k+1]*v[2*k+1]);
+        }
+    }
+};
+
+template<class T> class cphase : public map<T,T> {
+public:
+    cphase(virtualbuffer<T> & m) : map<T,T>(m) {}
+    virtual T operator[](int i) const {
+        return atan2(map<T,T>::a[2*i+1], map<T,T>::a[2*i]);
+    }
+};
+
+extern "C" int sl_mag() {
+    if( current->type == 34 ) current = new cmag<float>(*(virtualbuffer<float>*)current);
+    else if( current->type == 66 ) current = new cmag<double>(*(virtualbuffer<double>*)current);
+    return 0;
+}
+
+extern "C" int sl_phase() {
+    if( current->type == 34 ) current = new cphase<float>(*(virtualbuffer<float>*)current);
+    else if( current->type == 66 ) current = new cphase<double>(*(virtualbuffer<double>*)current);
+    return 0;
+}
+
+int convmode = 0;
+
+extern "C" int sl_boundary(int mode) {
+    convmode = mode;
+    return 0;
+}
+
+/* maps an out of range index onto [0,len) for the clamp, wrap and mirror modes, -1 for zero */
+inline int boundary(int j, int len, int mode) {
+    if( j >= 0 && (len == 0 || j < len) ) return j;
+    if( mode == 1 ) return j < 0 ? 0 : len-1;
+    if( mode == 2 && len > 0 ) return ((j%len)+len)%len;
+    if( mode == 3 && len > 0 ) {
+        int p = 2*len;
+        int r = ((j%p)+p)%p;
+        return r < len ? r : p-1-r;
+    }
+    return -1;
+}
+
+/* y[i] = sum h[j] x[i-j]; x outside [0,len) is zero, clamped, wrapped or mirrored (len 0 bounds only the low side) */
+template<class T> class conv : public map<T,T> {
+public:
+    conv(virtualbuffer<T> & m, const std::vector<double> & k, int md) : map<T,T>(m), h(k), mode(md), len(m.length), fftn(0) {
+        int kn = h.size();
+        int n = 1024;
+        while( n < 4*kn ) n <<= 1;
+        double lg = log2((double)n);
+        if( (double)kn*(n-kn+1) > 8.0*n*lg+6.0*n ) {
+            fftn = n;
+            std::vector<std::complex<double> > hp(n), hf(n);
+            for( int j = 0; j < kn; j++ ) hp[j] = h[j];
+            fftplan<double>::plan(n).run(&hp[0], &hf[0], false);
+            H = hf;
+        }
+    }
+    int bound(int j) const {
+        return boundary(j, len, mode);
+    }
+    void fetch(double* v, int lo, int cnt) const {
+        T t[1024];
+        int i = 0;
+        while( i < cnt ) {
+            int j = lo+i;
+            if( j >= 0 && (len == 0 || j < len) ) {
+                int m = cnt-i < 1024 ? cnt-i : 1024;
+                if( len > 0 && j+m > len ) m = len-j;
+                map<T,T>::a.get(t, j, m);
+                for( int k = 0; k < m; k++ ) v[i+k] = (double)t[k];
+                i += m;
+            } else {
+                int b = bound(j);
+                v[i++] = b < 0 ? 0.0 : (double)map<T,T>::a[b];
+            }
+        }
+    }
+    T out(double d) const {
+        return rounded<T>(d);
+    }
+    virtual T operator[](int i) const {
+        double acc = 0;
+        for( int j = 0; j < (int)h.size(); j++ ) {
+            int b = bound(i-j);
+            if( b >= 0 ) acc += h[j]*(double)map<T,T>::a[b];
+        }
+        return out(acc);
+    }
+    virtual void fill(T* o, int s, int n) const {
+        int kn = h.size();
+        if( fftn > 0 && n >= fftn-kn+1 ) {
+            int step = fftn-kn+1;
+            std::vector<double> v(fftn);
+            std::vector<std::complex<double> > x(fftn), y(fftn);
+            fftplan<double> & p = fftplan<double>::plan(fftn);
+            for( int i = 0; i < n; i += step ) {
+                int m = n-i < step ? n-i : step;
+                fetch(&v[0], s+i-kn+1, kn-1+m);
+                for( int k = 0; k < fftn; k++ ) x[k] = k < kn-1+m ? v[k] : 0.0;
+                p.run(&x[0], &y[0], false);
+                for( int k = 0; k < fftn; k++ ) y[k] *= H[k];
+                p.run(&y[0], &x[0], true);
+                for( int k = 0; k < m; k++ ) o[i+k] = out(x[kn-1+k].real()/fftn);
+            }
+            return;
+        }
+        std::vector<double> v(kn-1+1024), acc(1024);
+        for( int i = 0; i < n; i += 1024 ) {
+            int m = n-i < 1024 ? n-i : 1024;
+            fetch(&v[0], s+i-kn+1, kn-1+m);
+            for( int k = 0; k < m; k++ ) acc[k] = 0;
+            for( int j = 0; j < kn; j++ ) {
+                double hj = h[j];
+                const double* vj = &v[kn-1-j];
+                for( int k = 0; k < m; k++ ) acc[k] += hj*vj[k];
+            }
+            for( int k = 0; k < m; k++ ) o[i+k] = out(acc[k]);
+        }
+    }
+    std::vector<double> h;
+    int mode;
+    int len;
+    int fftn;
+    std::vector<std::complex<double> > H;
+};
+
+template<class T> simlab* subconv(simlab* sl, const std::vector<double> & k) {
+    return new conv<T>(*(virtualbuffer<T>*)sl, k, convmode);
+}
+
+extern "C" int sl_convolve(simlab* kernel) {
+    if( kernel->length <= 0 ) {
+        printf("convolve needs a materialized kernel\n");
+        return 1;
+    }
+    std::vector<double> k(kernel->length);
+    virtualbuffer<double> & kd = *(virtualbuffer<double>*)(kernel->type == 66 ? kernel : scast<cast>(66, kernel));
+    kd.fill(&k[0], 0, k.size());
+    if( current->type == 8 ) {
+        current = subconv<unsigned char>(current, k);
+    } else if( current->type == 9 ) {
+        current = subconv<char>(current, k);
+    } else if( current->type == 16 ) {
+        current = subconv<unsigned short>(current, k);
+    } else if( current->type == 17 ) {
+        current = subconv<short>(current, k);
+    } else if( current->type == 32 ) {
+        current = subconv<unsigned int>(current, k);
+    } else if( current->type == 33 ) {
+        current = subconv<int>(current, k);
+    } else if( current->type == 34 ) {
+        current = subconv<float>(current, k);
+    } else if( current->type == 64 ) {
+        current = subconv<unsigned long long>(current, k);
+    } else if( current->type == 65 ) {
+        current = subconv<long long>(current, k);
+    } else if( current->type == 66 ) {
+        current = subconv<double>(current, k);
+    } else if( current->type == 18 ) {
+        current = subconv<half>(current, k);
+    } else if( current->type == 19 ) {
+        current = subconv<bhalf>(current, k);
+    }
+    return 0;
+}
+
+int stileh = 64;
+int stilew = 256;
+
+/* correlates a width x height image with a square kernel in cache sized tiles; rank one kernels run as two 1D passes */
+template<class T> class stencil : public map<T,T> {
+public:
+    typedef typename std::conditional<sizeof(T) == 8, double, float>::type A;
+    stencil(virtualbuffer<T> & m, const std::vector<double> & k, int w, int md) : map<T,T>(m), kn((int)(sqrt((double)k.size())+0.5)), r(kn/2), width(w), height(w > 0 ? m.length/w : 0), mode(md), separable(false) {
+        for( size_t i = 0; i < k.size(); i++ ) ker.push_back((A)k[i]);
+        int pi = 0, pj = 0;
+        for( int i = 0; i < kn*kn; i++ ) if( fabs(k[i]) > fabs(k[pi*kn+pj]) ) {
+            pi = i/kn;
+            pj = i%kn;
+        }
+        double piv = k[pi*kn+pj];
+        if( piv != 0 ) {
+            separable = true;
+            for( int i = 0; i < kn && separable; i++ ) for( int j = 0; j < kn; j++ ) {
+                if( fabs(k[i*kn+j]*piv - k[i*kn+pj]*k[pi*kn+j]) > 1e-9*piv*piv ) {
+                    separable = false;
+                    break;
+                }
+            }
+            if( separable ) for( int i = 0; i < kn; i++ ) {
+                col.push_back((A)(k[i*kn+pj]/piv));
+                row.push_back((A)k[pi*kn+i]);
+            }
+        }
+    }
+    T out(A d) const {
+        return rounded<T>(d);
+    }
+    virtual T operator[](int i) const {
+        int y = i/width, x = i%width;
+        A acc = 0;
+        for( int u = 0; u < kn; u++ ) {
+            int yy = boundary(y+u-r, height, mode);
+            if( yy < 0 ) continue;
+            for( int v = 0; v < kn; v++ ) {
+                int xx = boundary(x+v-r, width, mode);
+                if( xx >= 0 ) acc += ker[u*kn+v]*(A)map<T,T>::a[yy*width+xx];
+            }
+        }
+        return out(acc);
+    }
+    void window(A* win, int y0, int x0, int h, int w) const {
+        T t[1024];
+        for( int y = 0; y < h; y++ ) {
+            A* dst = win+y*w;
+            int yy = boundary(y0+y, height, mode);
+            if( yy < 0 ) {
+                for( int x = 0; x < w; x++ ) dst[x] = 0;
+                continue;
+            }
+            int x = 0;
+            while( x < w ) {
+                int xx = x0+x;
+                if( xx >= 0 && xx < width ) {
+                    int m = w-x < width-xx ? w-x : width-xx;
+                    if( m > 1024 ) m = 1024;
+                    map<T,T>::a.get(t, yy*width+xx, m);
+                    for( int k = 0; k < m; k++ ) dst[x+k] = (A)t[k];
+                    x += m;
+                } else {
+                    int b = boundary(xx, width, mode);
+                    dst[x++] = b < 0 ? 0 : (A)map<T,T>::a[yy*width+b];
+                }
+            }
+        }
+    }
+    void tile(T* o, int s, int n, int ty, int tx, int th, int tw) const {
+        int wh = th+2*r, ww = tw+2*r;
+        std::vector<A> win(wh*ww), acc(tw), tmp(separable ? wh*tw : 0);
+        window(&win[0], ty-r, tx-r, wh, ww);
+        if( separable ) {
+            for( int y = 0; y < wh; y++ ) {
+                A* t = &tmp[y*tw];
+                for( int x = 0; x < tw; x++ ) t[x] = 0;
+                for( int v = 0; v < kn; v++ ) {
+                    A k = row[v];
+                    const A* src = &win[y*ww+v];
+                    for( int x = 0; x < tw; x++ ) t[x] += k*src[x];
+                }
+            }
+        }
+        for( int y = 0; y < th; y++ ) {
+            for( int x = 0; x < tw; x++ ) acc[x] = 0;
+            for( int u = 0; u < kn; u++ ) {
+                if( separable ) {
+                    A k = col[u];
+                    const A* src = &tmp[(y+u)*tw];
+                    for( int x = 0; x < tw; x++ ) acc[x] += k*src[x];
+                } else for( int v = 0; v < kn; v++ ) {
+                    A k = ker[u*kn+v];
+                    const A* src = &win[(y+u)*ww+v];
+                    for( int x = 0; x < tw; x++ ) acc[x] += k*src[x];
+                }
+            }
+            long long base = (long long)(ty+y)*width+tx;
+            for( int x = 0; x < tw; x++ ) {
+                long long i = base+x;
+                if( i >= s && i < (long long)s+n ) o[i-s] = out(acc[x]);
+            }
+        }
+    }
+    virtual void fill(T* o, int s, int n) const {
+        if( n <= 0 ) return;
+        int y0 = s/width, y1 = (s+n-1)/width+1;
+        int tiley = (y1-y0+stileh-1)/stileh, tilex = (width+stilew-1)/stilew;
+        parallel(tiley*tilex, [&](int b, int e) {
+            for( int t = b; t < e; t++ ) {
+                int ty = y0+(t/tilex)*stileh, tx = (t%tilex)*stilew;
+                int th = y1-ty < stileh ? y1-ty : stileh, tw = width-tx < stilew ? width-tx : stilew;
+                int x0 = ty == y0 ? s%width : 0;
+                int x1 = ty+th == y1 ? (s+n-1)%width+1 : width;
+                if( th == 1 && (tx+tw <= x0 || tx >= x1) ) continue;
+                tile(o, s, n, ty, tx, th, tw);
+            }
+        });
+    }
+    int kn;
+    int r;
+    int width;
+    int height;
+    int mode;
+    bool separable;
+    std::vector<A> ker;
+    std::vector<A> row;
+    std::vector<A> col;
+};
+
+template<class T> simlab* substencil(simlab* sl, const std::vector<double> & k, int width) {
+    return new stencil<T>(*(virtualbuffer<T>*)sl, k, width, convmode);
+}
+
+extern "C" int sl_stencil(simlab* kernel, int width) {
+    int kn = (int)(sqrt((double)kernel->length)+0.5);
+    if( kernel->length <= 0 || kn*kn != kernel->length || kn%2 == 0 || width <= 0 ) {
+        printf("stencil needs a materialized odd square kernel and a width\n");
+        return 1;
+    }
+    std::vector<double> k(kernel->length);
+    virtualbuffer<double> & kd = *(virtualbuffer<double>*)(kernel->type == 66 ? kernel : scast<cast>(66, kernel));
+    kd.fill(&k[0], 0, k.size());
+    if( current->type == 8 ) {
+        current = substencil<unsigned char>(current, k, width);
+    } else if( current->type == 9 ) {
+        current = substencil<char>(current, k, width);
+    } else if( current->type == 16 ) {
+        current = substencil<unsigned short>(current, k, width);
+    } else if( current->type == 17 ) {
+        current = substencil<short>(current, k, width);
+    } else if( current->type == 32 ) {
+        current = substencil<unsigned int>(current, k, width);
+    } else if( current->type == 33 ) {
+        current = substencil<int>(current, k, width);
+    } else if( current->type == 34 ) {
+        current = substencil<float>(current, k, width);
+    } else if( current->type == 64 ) {
+        current = substencil<unsigned long long>(current, k, width);
+    } else if( current->type == 65 ) {
+        current = substencil<long long>(current, k, width);
+    } else if( current->type == 66 ) {
+        current = substencil<double>(current, k, width);
+    } else if( current->type == 18 ) {
+        current = substencil<half>(current, k, width);
+    } else if( current->type == 19 ) {
+        current = substencil<bhalf>(current, k, width);
+    }
+    return 0;
+}
+
+extern "C" int sl_stenciltile(int h, int w) {
+    stileh = h > 0 ? h : 1;
+    stilew = w > 0 ? w : 1;
+    return 0;
+}
+
+int gemmmc = 128;
+int gemmkc = 256;
+int gemmnc = 4096;
+
+/* row major operand addressed with row and column strides so transposed sources need no copy */
+template<class T> struct matview {
+    const T* p;
+    long long rs;
+    long long cs;
+    T at(int i, int j) const { return p[i*rs+j*cs]; }
+};
+
+/* register block of C: MR rows by NR columns accumulated over kc packed steps */
+template<class T,int MR,int NR> inline void microkernel(int kc, const T* a, const T* b, T* c, int ldc, int mr, int nr, bool first) {
+    T acc[MR][NR];
+    for( int i = 0; i < MR; i++ ) for( int j = 0; j < NR; j++ ) acc[i][j] = 0;
+    for( int p = 0; p < kc; p++ ) {
+        const T* bp = b+p*NR;
+        for( int i = 0; i < MR; i++ ) {
+            T av = a[p*MR+i];
+            for( int j = 0; j < NR; j++ ) acc[i][j] += av*bp[j];
+        }
+    }
+    for( int i = 0; i < mr; i++ ) for( int j = 0; j < nr; j++ ) {
+        if( first ) c[i*ldc+j] = acc[i][j];
+        else c[i*ldc+j] += acc[i][j];
+    }
+}
+
+template<class T> void gemm(const matview<T> & A, const matview<T> & B, T* C, int m, int k, int n) {
+    const int MR = 4, NR = 32/sizeof(T);
+    int mc = (gemmmc+MR-1)/MR*MR, kc = gemmkc, nc = (gemmnc+NR-1)/NR*NR;
+    if( k == 0 ) {
+        memset(C, 0, (size_t)m*n*sizeof(T));
+        return;
+    }
+    scratch sp(((size_t)kc*nc+(size_t)mc*kc*(threads < m/mc+1 ? threads : m/mc+1))*sizeof(T));
+    std::vector<T> pb((size_t)kc*nc);
+    for( int jc = 0; jc < n; jc += nc ) {
+        int nb = n-jc < nc ? n-jc : nc;
+        int panels = (nb+NR-1)/NR;
+        for( int pc = 0; pc < k; pc += kc ) {
+            int kb = k-pc < kc ? k-pc : kc;
+            parallel(panels, [&](int s, int e) {
+                for( int jr = s; jr < e; jr++ ) {
+                    T* d = &pb[(size_t)jr*kb*NR];
+                    for( int p = 0; p < kb; p++ ) for( int j = 0; j < NR; j++ ) {
+                        int jj = jr*NR+j;
+                        d[p*NR+j] = jj < nb ? B.at(pc+p, jc+jj) : 0;
+                    }
+                }
+            });
+            parallel((m+mc-1)/mc, [&](int s, int e) {
+                std::vector<T> pa((size_t)mc*kb);
+                for( int blk = s; blk < e; blk++ ) {
+                    int ic = blk*mc, mb = m-ic < mc ? m-ic : mc;
+                    for( int ir = 0; ir < mb; ir += MR ) {
+                        T* d = &pa[(size_t)ir*kb];
+                        for( int p = 0; p < kb; p++ ) for( int i = 0; i < MR; i++ ) d[p*MR+i] = ir+i < mb ? A.at(ic+ir+i, pc+p) : 0;
+                    }
+                    for( int jr = 0; jr < panels; jr++ ) {
+                        int nr = nb-jr*NR < NR ? nb-jr*NR : NR;
+                        for( int ir = 0; ir < mb; ir += MR ) {
+                            int mr = mb-ir < MR ? mb-ir : MR;
+                            microkernel<T,MR,NR>(kb, &pa[(size_t)ir*kb], &pb[(size_t)jr*kb*NR], C+(size_t)(ic+ir)*n+jc+jr*NR, n, mr, nr, pc == 0);
+                        }
+                    }
+                }
+            });
+        }
+    }
+}
+
+/* reads a rows x cols operand in place from a buffer or a mapping of a buffer through trans, otherwise evaluates it into tmp */
+template<class T> matview<T> operand(simlab* sl, int rows, int cols, std::vector<T> & tmp) {
+    matview<T> v;
+    if( sl->data() != NULL && (long long)sl->length >= (long long)rows*cols ) {
+        v.p = (const T*)sl->data();
+        v.rs = cols;
+        v.cs = 1;
+        return v;
+    }
+    mapping<T>* mp = dynamic_cast<mapping<T>*>(sl);
+    const trans* t = mp != NULL ? dynamic_cast<const trans*>(&mp->a) : NULL;
+    if( t != NULL && mp->b.data() != NULL && t->cls[0] == rows && t->rws[0] == cols && (long long)mp->b.length >= (long long)rows*cols ) {
+        v.p = (const T*)mp->b.data();
+        v.rs = 1;
+        v.cs = rows;
+        return v;
+    }
+    virtualbuffer<T> & vb = *(virtualbuffer<T>*)sl;
+    tmp.resize((size_t)rows*cols);
+    parallel(rows*cols, [&](int s, int e) { vb.fill(&tmp[s], s, e-s); });
+    v.p = &tmp[0];
+    v.rs = cols;
+    v.cs = 1;
+    return v;
+}
+
+template<class T> simlab* submatmul(simlab* a, simlab* b, int m, int k, int n) {
+    std::vector<T> ta, tb;
+    matview<T> A = operand<T>(a, m, k, ta), B = operand<T>(b, k, n, tb);
+    buffer<T>* c = new buffer<T>(m*n);
+    gemm<T>(A, B, c->buf, m, k, n);
+    return c;
+}
+
+extern "C" int sl_matmul(simlab* b, int m, int k, int n) {
+    if( m <= 0 || k < 0 || n <= 0 ) {
+        printf("matmul needs positive dimensions\n");
+        return 1;
+    }
+    if( (current->length != 0 && current->length < m*k) || (b->length != 0 && b->length < k*n) ) {
+        printf("matmul operands are shorter than %dx%d and %dx%d\n", m, k, k, n);
+        return 1;
+    }
+    simlab* vb = b->type == current->type ? b : scast<cast>(current->type, b);
+    if( current->type == 33 ) {
+        current = submatmul<int>(current, vb, m, k, n);
+    } else if( current->type == 34 ) {
+        current = submatmul<float>(current, vb, m, k, n);
+    } else if( current->type == 66 ) {
+        current = submatmul<double>(current, vb, m, k, n);
+    } else {
+        printf("matmul supports int, float and double\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* counts values of an 8 or 16 bit input directly by value, four interleaved tables hide repeated increments of one slot */
+template<class T> void valuecount(virtualbuffer<T> & vb, int s, int e, long long* cnt) {
+    typedef typename std::conditional<sizeof(T) == 1, unsigned char, unsigned short>::type U;
+    const int V = 1 << (8*sizeof(U));
+    std::vector<unsigned int> c(4*V);
+    const T* d = (const T*)vb.data();
+    T t[1024];
+    for( int i = s; i < e; i += 1024 ) {
+        int m = e-i < 1024 ? e-i : 1024;
+        const T* v = d != NULL ? d+i : t;
+        if( d == NULL ) vb.fill(t, i, m);
+        int j = 0;
+        for( ; j+4 <= m; j += 4 ) {
+            c[(U)v[j]]++;
+            c[V+(U)v[j+1]]++;
+            c[2*V+(U)v[j+2]]++;
+            c[3*V+(U)v[j+3]]++;
+        }
+        for( ; j < m; j++ ) c[(U)v[j]]++;
+    }
+    for( int k = 0; k < V; k++ ) cnt[k] = (long long)c[k]+c[V+k]+c[2*V+k]+c[3*V+k];
+}
+
+template<class T> simlab* subhist(simlab* sl, int len, int bins, double lo, double hi) {
+    virtualbuffer<T> & vb = *(virtualbuffer<T>*)sl;
+    buffer<long long>* h = new buffer<long long>(bins);
+    memset(h->buf, 0, bins*sizeof(long long));
+    double scale = bins/(hi-lo);
+    std::mutex hm;
+    if( sizeof(T) <= 2 && std::numeric_limits<T>::is_integer ) {
+        const int V = sizeof(T) == 1 ? 256 : 65536;
+        std::vector<long long> cnt(V);
+        parallel(len, [&](int s, int e) {
+            std::vector<long long> c(V);
+            valuecount<T>(vb, s, e, &c[0]);
+            std::lock_guard<std::mutex> lk(hm);
+            for( int k = 0; k < V; k++ ) cnt[k] += c[k];
+        });
+        for( int k = 0; k < V; k++ ) {
+            double x = (double)(T)k;
+            if( cnt[k] == 0 || !(x >= lo && x <= hi) ) continue;
+            int b = (int)((x-lo)*scale);
+            h->buf[b < bins ? b : bins-1] += cnt[k];
+        }
+        return h;
+    }
+    parallel(len, [&](int s, int e) {
+        std::vector<long long> c(bins+1);
+        const T* d = (const T*)vb.data();
+        T t[1024];
+        int ix[1024];
+        for( int i = s; i < e; i += 1024 ) {
+            int m = e-i < 1024 ? e-i : 1024;
+            const T* v = d != NULL ? d+i : t;
+            if( d == NULL ) vb.fill(t, i, m);
+            for( int j = 0; j < m; j++ ) {
+                double x = (double)v[j];
+                double f = x >= lo && x <= hi ? (x-lo)*scale : -1.0;
+                int b = (int)f;
+                b = b < bins ? b : bins-1;
+                ix[j] = f < 0 ? bins : b;
+            }
+            for( int j = 0; j < m; j++ ) c[ix[j]]++;
+        }
+        std::lock_guard<std::mutex> lk(hm);
+        for( int k = 0; k < bins; k++ ) h->buf[k] += c[k];
+    });
+    return h;
+}
+
+/* counts the first len values, len <= 0 takes the length of a finite input */
+extern "C" int sl_hist(int len, int bins, simlab* lo, simlab* hi) {
+    double l = (*(virtualbuffer<double>*)scast<cast>(66, lo))[0];
+    double u = (*(virtualbuffer<double>*)scast<cast>(66, hi))[0];
+    if( len <= 0 || (current->length > 0 && len > current->length) ) len = current->length;
+    if( bins <= 0 || !(u > l) || len <= 0 ) {
+        printf("hist needs a length, bins and lo < hi\n");
+        return 1;
+    }
+    if( current->type == 8 ) {
+        current = subhist<unsigned char>(current, len, bins, l, u);
+    } else if( current->type == 9 ) {
+        current = subhist<char>(current, len, bins, l, u);
+    } else if( current->type == 16 ) {
+        current = subhist<unsigned short>(current, len, bins, l, u);
+    } else if( current->type == 17 ) {
+        current = subhist<short>(current, len, bins, l, u);
+    } else if( current->type == 32 ) {
+        current = subhist<unsigned int>(current, len, bins, l, u);
+    } else if( current->type == 33 ) {
+        current = subhist<int>(current, len, bins, l, u);
+    } else if( current->type == 34 ) {
+        current = subhist<float>(current, len, bins, l, u);
+    } else if( current->type == 64 ) {
+        current = subhist<unsigned long long>(current, len, bins, l, u);
+    } else if( current->type == 65 ) {
+        current = subhist<long long>(current, len, bins, l, u);
+    } else if( current->type == 66 ) {
+        current = subhist<double>(current, len, bins, l, u);
+    } else if( current->type == 18 ) {
+        current = subhist<half>(current, len, bins, l, u);
+    } else if( current->type == 19 ) {
+        current = subhist<bhalf>(current, len, bins, l, u);
+    }
+    return 0;
+}
+
+template<template<class M> class T> simlab* sarith(simlab* sl) {
+    if( sl->type == 8 ) {
+        return new T<unsigned char>(*(virtualbuffer<unsigned char>*)sl);
+    } else if( sl->type == 9 ) {
+        return new T<char>(*(virtualbuffer<char>*)sl);
+    } else if( sl->type == 16 ) {
+        return new T<unsigned short>(*(virtualbuffer<unsigned short>*)sl);
+    } else if( sl->type == 17 ) {
+        return new T<short>(*(virtualbuffer<short>*)sl);
+    } else if( sl->type == 32 ) {
+        return new T<unsigned int>(*(virtualbuffer<unsigned int>*)sl);
+    } else if( sl->type == 33 ) {
+        return new T<int>(*(virtualbuffer<int>*)sl);
+    } else if( sl->type == 34 ) {
+        return new T<float>(*(virtualbuffer<float>*)sl);
+    } else if( sl->type == 64 ) {
+        return new T<unsigned long long>(*(virtualbuffer<unsigned long long>*)sl);
+    } else if( sl->type == 65 ) {
+        return new T<long long>(*(virtualbuffer<long long>*)sl);
+    } else if( sl->type == 66 ) {
+        return new T<double>(*(virtualbuffer<double>*)sl);
+    } else if( sl->type == 18 ) {
+        return new T<half>(*(virtualbuffer<half>*)sl);
+    } else if( sl->type == 19 ) {
+        return new T<bhalf>(*(virtualbuffer<bhalf>*)sl);
+    }
+    return NULL;
+}
+
+extern "C" int sl_bswap() {
+    current = sarith<bswap>(current);
+    return 0;
+}
+
+bool bigendian() {
+    unsigned short one = 1;
+    return *(unsigned char*)&one == 0;
+}
+
+extern "C" int sl_pcastbe(simlab* sl) {
+    current = nativecast((*(virtualbuffer<int>*)sl)[0], current);
+    if( !bigendian() ) sl_bswap();
+    return 0;
+}
+
+extern "C" int sl_pcastle(simlab* sl) {
+    current = nativecast((*(virtualbuffer<int>*)sl)[0], current);
+    if( bigendian() ) sl_bswap();
+    return 0;
+}
+
+extern "C" int sl_cosf() {
+    current = sarith<slc_cosf>(current);
+    return 0;
+}
+
+extern "C" int sl_cos() {
+    current = sarith<slc_cos>(current);
+    return 0;
+}
+
+extern "C" int sl_sinf() {
+    current = sarith<slc_sinf>(current);
+    return 0;
+}
+
+extern "C" int sl_sin() {
+    current = sarith<slc_sin>(current);
+    return 0;
+}
+
+extern "C" int sl_logf() {
+    current = sarith<slc_logf>(current);
+    return 0;
+}
+
+extern "C" int sl_log() {
+    current = sarith<slc_log>(current);
+    return 0;
+}
+
+extern "C" int sl_floorf() {
+    current = sarith<slc_floorf>(current);
+    return 0;
+}
+
+extern "C" int sl_floor() {
+    current = sarith<slc_floor>(current);
+    return 0;
+}
+
+/*template<class T> int tsl_add(virtualbuffer<T>* a, simlab* b) {
+    if( b->type == 32 ) {
+        current = new sum<T,unsigned int>(*a, *b);
+    } else if( b->type == 33 ) {
+        current = new sum<T,unsigned int>(*a, *b);
+    }
+
+    return 0;
+}*/
+
+template<typename K,template<class M> class T> simlab* submarith(virtualbuffer<K> & sl, simlab* b) {
+    if( sl.type == b->type ) return new T<K>(sl, *(virtualbuffer<K>*)b);
+    else {
+        virtualbuffer<K> & vk = *(virtualbuffer<K>*)scast<cast>(sl.type,b);
+        return new T<K>(sl, vk);
+    }
+    /*if( b->type == 32 ) {
+        return new T<K>(sl, *(virtualbuffer<unsigned int>*)b);
+    } else if( b->type == 66 ) {
+        return new T<K>(sl, *(virtualbuffer<double>*)b);
+    }*/
+    return NULL;
+}
+
+template<template<class M> class T> simlab* marith(simlab* sl, simlab* b) {
+    if( sl->type == 8 ) {
+        return submarith<unsigned char,T>(*(virtualbuffer<unsigned char>*)sl, b);
+    } else if( sl->type == 9 ) {
+        return submarith<char,T>(*(virtualbuffer<char>*)sl, b);
+    } else if( sl->type == 16 ) {
+        return submarith<unsigned short,T>(*(virtualbuffer<unsigned short>*)sl, b);
+    } else if( sl->type == 17 ) {
+        return submarith<short,T>(*(virtualbuffer<short>*)sl, b);
+    } else if( sl->type == 32 ) {
+        return submarith<unsigned int,T>(*(virtualbuffer<unsigned int>*)sl, b);
+    } else if( sl->type == 33 ) {
+        return submarith<int,T>(*(virtualbuffer<int>*)sl, b);
+    } else if( sl->type == 34 ) {
+        return submarith<float,T>(*(virtualbuffer<float>*)sl, b);
+    } else if( sl->type == 64 ) {
+        return submarith<unsigned long long,T>(*(virtualbuffer<unsigned long long>*)sl, b);
+    } else if( sl->type == 65 ) {
+        return submarith<long long,T>(*(virtualbuffer<long long>*)sl, b);
+    } else if( sl->type == 66 ) {
+        return submarith<double,T>(*(virtualbuffer<double>*)sl, b);
+    } else if( sl->type == 18 ) {
+        return submarith<half,T>(*(virtualbuffer<half>*)sl, b);
+    } else if( sl->type == 19 ) {
+        return submarith<bhalf,T>(*(virtualbuffer<bhalf>*)sl, b);
+    }
+    return NULL;
+}
+
+template<typename K,template<class M> class T> simlab* subtarith(virtualbuffer<K> & sl, simlab* b, simlab* c) {
+    virtualbuffer<K> & vb = *(virtualbuffer<K>*)(sl.type == b->type ? b : scast<cast>(sl.type,b));
+    virtualbuffer<K> & vc = *(virtualbuffer<K>*)(sl.type == c->type ? c : scast<cast>(sl.type,c));
+    return new T<K>(sl, vb, vc);
+}
+
+template<template<class M> class T> simlab* tarith(simlab* sl, simlab* b, simlab* c) {
+    if( sl->type == 8 ) {
+        return subtarith<unsigned char,T>(*(virtualbuffer<unsigned char>*)sl, b, c);
+    } else if( sl->type == 9 ) {
+        return subtarith<char,T>(*(virtualbuffer<char>*)sl, b, c);
+    } else if( sl->type == 16 ) {
+        return subtarith<unsigned short,T>(*(virtualbuffer<unsigned short>*)sl, b, c);
+    } else if( sl->type == 17 ) {
+        return subtarith<short,T>(*(virtualbuffer<short>*)sl, b, c);
+    } else if( sl->type == 32 ) {
+        return subtarith<unsigned int,T>(*(virtualbuffer<unsigned int>*)sl, b, c);
+    } else if( sl->type == 33 ) {
+        return subtarith<int,T>(*(virtualbuffer<int>*)sl, b, c);
+    } else if( sl->type == 34 ) {
+        return subtarith<float,T>(*(virtualbuffer<float>*)sl, b, c);
+    } else if( sl->type == 64 ) {
+        return subtarith<unsigned long long,T>(*(virtualbuffer<unsigned long long>*)sl, b, c);
+    } else if( sl->type == 65 ) {
+        return subtarith<long long,T>(*(virtualbuffer<long long>*)sl, b, c);
+    } else if( sl->type == 66 ) {
+        return subtarith<double,T>(*(virtualbuffer<double>*)sl, b, c);
+    } else if( sl->type == 18 ) {
+        return subtarith<half,T>(*(virtualbuffer<half>*)sl, b, c);
+    } else if( sl->type == 19 ) {
+        return subtarith<bhalf,T>(*(virtualbuffer<bhalf>*)sl, b, c);
+    }
+    return NULL;
+}
+
+extern "C" int sl_neg() {
+    if( current->type == 32 ) {
+        current = new neg<unsigned int>(*(virtualbuffer<unsigned int>*)current);
+    } else if( current->type == 33 ) {
+        current = new neg<int>(*(virtualbuffer<int>*)current);
+    } else if( current->type == 34 ) {
+        current = new neg<float>(*(virtualbuffer<float>*)current);
+    } else if( current->type == 18 ) {
+        current = new neg<half>(*(virtualbuffer<half>*)current);
+    } else if( current->type == 19 ) {
+        current = new neg<bhalf>(*(virtualbuffer<bhalf>*)current);
+    }
+    return 0;
+}
+
+extern "C" int sl_div(simlab* b) {
+    current = marith<divd>(current, b);
     return 0;
 }
 
@@ -695,8 +3456,56 @@ extern "C" int sl_mod(simlab* b) {
     return 0;
 }
 
+extern "C" int sl_lt(simlab* b) {
+    current = marith<lt>(current, b);
+    return 0;
+}
+
+extern "C" int sl_gt(simlab* b) {
+    current = marith<gt>(current, b);
+    return 0;
+}
+
+extern "C" int sl_eq(simlab* b) {
+    current = marith<eq>(current, b);
+    return 0;
+}
+
+extern "C" int sl_min(simlab* b) {
+    current = marith<vmin>(current, b);
+    return 0;
+}
+
+extern "C" int sl_max(simlab* b) {
+    current = marith<vmax>(current, b);
+    return 0;
+}
+
+extern "C" int sl_clamp(simlab* lo, simlab* hi) {
+    current = tarith<clamp>(current, lo, hi);
+    return 0;
+}
+
+/* current is the mask; the result has the type of a, b and the mask are converted to it */
+extern "C" int sl_select(simlab* a, simlab* b) {
+    current = tarith<choose>(a, b, current);
+    return 0;
+}
+
 template<typename T> void print(virtualbuffer<T> & vb, const char* nl, const char* tl, int length, int cols) {
-    for( int i = 0; i < length; i++ ) printf( i%cols==0 ? nl : tl, vb[i] );
+    fflush(stdout);
+    pipeline(length, [&](long long st, int n, std::vector<char> & out) {
+        std::vector<T> v(n);
+        vb.fill(v.data(), (int)st, n);
+        char num[64];
+        for( int k = 0; k < n; k++ ) {
+            int i = (int)st+k;
+            int w = snprintf(num, sizeof(num), i%cols==0 ? nl : tl, v[k]);
+            out.insert(out.end(), num, num+w);
+        }
+    }, [&](const std::vector<char> & out) {
+        return fwrite(out.data(), 1, out.size(), stdout) == out.size();
+    });
 }
 
 extern "C" int sl_print(int cols, int rows) {
@@ -730,17 +3539,352 @@ extern "C" int sl_print(int cols, int rows) {
     } else if( current->type == 66 ) {
         virtualbuffer<double> & fvb = *(virtualbuffer<double>*)current;
         print<double>(fvb, "\n%e", "\t%e", rows*cols, cols);
+    } else if( current->type == 18 || current->type == 19 ) {
+        virtualbuffer<float> & fvb = *(virtualbuffer<float>*)scast<cast>(34, current);
+        print<float>(fvb, "\n%f", "\t%f", rows*cols, cols);
+        delete &fvb;
+    }
+    return 0;
+}
+
+extern "C" int sl_const(simlab* c) {
+    current = c;
+    return 0;
+}
+
+int imagechannels = 3;
+int imagedepth = 8;
+int imagenorm = 0;
+
+extern "C" int sl_imageformat(int channels, int depth) {
+    imagechannels = channels;
+    imagedepth = depth > 8 ? 16 : 8;
+    return 0;
+}
+
+extern "C" int sl_imagenorm(int norm) {
+    imagenorm = norm;
+    return 0;
+}
+
+template<class T> void samples(virtualbuffer<T> & vb, int len, unsigned short* out) {
+    T* v = new T[len];
+    parallel(len, [&](int s, int e) {
+        vb.fill(v+s, s, e-s);
+    });
+    double maxv = (1<<imagedepth)-1;
+    double lo = 0;
+    double scale = std::numeric_limits<T>::is_integer ? 1.0 : maxv;
+    if( imagenorm && len > 0 ) {
+        double hi = v[0];
+        lo = v[0];
+        for( int i = 1; i < len; i++ ) {
+            if( v[i] < lo ) lo = v[i];
+            if( v[i] > hi ) hi = v[i];
+        }
+        scale = hi > lo ? maxv/(hi-lo) : 0;
+    }
+    parallel(len, [&](int s, int e) {
+        for( int i = s; i < e; i++ ) {
+            double d = ((double)v[i]-lo)*scale;
+            out[i] = d < 0 ? 0 : d > maxv ? (unsigned short)maxv : (unsigned short)(d+0.5);
+        }
+    });
+    delete[] v;
+}
+
+template<class T> void ssamples(simlab* sl, int len, unsigned short* out) {
+    samples<T>(*(virtualbuffer<T>*)sl, len, out);
+}
+
+int tsamples(simlab* sl, int len, unsigned short* out) {
+    if( sl->type == 8 ) ssamples<unsigned char>(sl, len, out);
+    else if( sl->type == 9 ) ssamples<char>(sl, len, out);
+    else if( sl->type == 16 ) ssamples<unsigned short>(sl, len, out);
+    else if( sl->type == 17 ) ssamples<short>(sl, len, out);
+    else if( sl->type == 32 ) ssamples<unsigned int>(sl, len, out);
+    else if( sl->type == 33 ) ssamples<int>(sl, len, out);
+    else if( sl->type == 34 ) ssamples<float>(sl, len, out);
+    else if( sl->type == 64 ) ssamples<unsigned long long>(sl, len, out);
+    else if( sl->type == 65 ) ssamples<long long>(sl, len, out);
+    else if( sl->type == 66 ) ssamples<double>(sl, len, out);
+    else if( sl->type == 18 ) ssamples<half>(sl, len, out);
+    else if( sl->type == 19 ) ssamples<bhalf>(sl, len, out);
+    else return 1;
+    return 0;
+}
+
+class bitwriter {
+public:
+    bitwriter() : acc(0), n(0) {}
+    void put(unsigned int bits, int count) {
+        acc |= (unsigned long long)bits << n;
+        n += count;
+        while( n >= 8 ) {
+            out.push_back((unsigned char)acc);
+            acc >>= 8;
+            n -= 8;
+        }
+    }
+    void putrev(unsigned int code, int count) {
+        unsigned int r = 0;
+        for( int i = 0; i < count; i++ ) r |= ((code>>i)&1) << (count-1-i);
+        put(r, count);
+    }
+    void align() {
+        if( n > 0 ) put(0, 8-n);
+    }
+    std::vector<unsigned char> out;
+    unsigned long long acc;
+    int n;
+};
+
+void fixedlit(bitwriter & bw, int v) {
+    if( v < 144 ) bw.putrev(0x30+v, 8);
+    else if( v < 256 ) bw.putrev(0x190+v-144, 9);
+    else if( v < 280 ) bw.putrev(v-256, 7);
+    else bw.putrev(0xc0+v-280, 8);
+}
+
+const unsigned short lenbase[] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+const unsigned char lenextra[] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+const unsigned short distbase[] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+const unsigned char distextra[] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+void fixedmatch(bitwriter & bw, int len, int dist) {
+    int l = 28;
+    while( lenbase[l] > len ) l--;
+    fixedlit(bw, 257+l);
+    bw.put(len-lenbase[l], lenextra[l]);
+    int d = 29;
+    while( distbase[d] > dist ) d--;
+    bw.putrev(d, 5);
+    bw.put(dist-distbase[d], distextra[d]);
+}
+
+/* one non-final fixed-huffman block followed by an empty stored block so bands concatenate on byte boundaries */
+std::vector<unsigned char> deflateband(const unsigned char* data, int len) {
+    bitwriter bw;
+    bw.put(2, 3);
+    std::vector<int> head(1<<15, -1);
+    std::vector<int> chain(len);
+    int i = 0;
+    while( i < len ) {
+        int best = 0;
+        int bdist = 0;
+        if( i+3 <= len ) {
+            int h = ((data[i]<<10) ^ (data[i+1]<<5) ^ data[i+2]) & 0x7fff;
+            int m = head[h];
+            int tries = 32;
+            int maxl = len-i < 258 ? len-i : 258;
+            while( m >= 0 && i-m <= 32768 && tries-- > 0 ) {
+                int l = 0;
+                while( l < maxl && data[m+l] == data[i+l] ) l++;
+                if( l > best ) {
+                    best = l;
+                    bdist = i-m;
+                    if( l == maxl ) break;
+                }
+                m = chain[m];
+            }
+            chain[i] = head[h];
+            head[h] = i;
+        }
+        if( best >= 3 ) {
+            fixedmatch(bw, best, bdist);
+            for( int k = 1; k < best; k++ ) {
+                if( i+k+3 <= len ) {
+                    int h = ((data[i+k]<<10) ^ (data[i+k+1]<<5) ^ data[i+k+2]) & 0x7fff;
+                    chain[i+k] = head[h];
+                    head[h] = i+k;
+                }
+            }
+            i += best;
+        } else {
+            fixedlit(bw, data[i]);
+            i++;
+        }
+    }
+    fixedlit(bw, 256);
+    bw.put(0, 3);
+    bw.align();
+    bw.put(0, 16);
+    bw.put(0xffff, 16);
+    return bw.out;
+}
+
+unsigned int adler32(const unsigned char* data, int len) {
+    unsigned int a = 1, b = 0;
+    while( len > 0 ) {
+        int n = len < 5552 ? len : 5552;
+        len -= n;
+        while( n-- ) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b<<16) | a;
+}
+
+unsigned int adler32combine(unsigned int a1, unsigned int a2, int len2) {
+    const unsigned int base = 65521;
+    unsigned int rem = len2 % base;
+    unsigned int s1 = a1 & 0xffff;
+    unsigned int s2 = (rem*s1) % base;
+    s1 += (a2 & 0xffff) + base - 1;
+    s2 += (a1 >> 16) + (a2 >> 16) + base - rem;
+    if( s1 >= base ) s1 -= base;
+    if( s1 >= base ) s1 -= base;
+    if( s2 >= 2*base ) s2 -= 2*base;
+    if( s2 >= base ) s2 -= base;
+    return (s2<<16) | s1;
+}
+
+unsigned int crc32(unsigned int crc, const unsigned char* data, int len) {
+    static unsigned int table[256];
+    if( table[1] == 0 ) {
+        for( unsigned int n = 0; n < 256; n++ ) {
+            unsigned int c = n;
+            for( int k = 0; k < 8; k++ ) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    }
+    crc = ~crc;
+    for( int i = 0; i < len; i++ ) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void pngchunk(FILE* f, const char* type, const unsigned char* data, int len) {
+    unsigned char hdr[8] = {(unsigned char)(len>>24), (unsigned char)(len>>16), (unsigned char)(len>>8), (unsigned char)len};
+    memcpy(hdr+4, type, 4);
+    fwrite(hdr, 1, 8, f);
+    if( len > 0 ) fwrite(data, 1, len, f);
+    unsigned int crc = crc32(crc32(0, hdr+4, 4), data, len);
+    unsigned char c[4] = {(unsigned char)(crc>>24), (unsigned char)(crc>>16), (unsigned char)(crc>>8), (unsigned char)crc};
+    fwrite(c, 1, 4, f);
+}
+
+inline int paeth(int a, int b, int c) {
+    int p = a+b-c;
+    int pa = abs(p-a), pb = abs(p-b), pc = abs(p-c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+void filterrow(const unsigned char* row, const unsigned char* up, int rowbytes, int bpp, unsigned char* out) {
+    std::vector<unsigned char> cand[5];
+    long best = -1;
+    int bf = 0;
+    for( int f = 0; f < 5; f++ ) {
+        long cost = 0;
+        cand[f].resize(rowbytes);
+        for( int i = 0; i < rowbytes; i++ ) {
+            int a = i >= bpp ? row[i-bpp] : 0;
+            int b = up ? up[i] : 0;
+            int c = up && i >= bpp ? up[i-bpp] : 0;
+            int p = f == 0 ? 0 : f == 1 ? a : f == 2 ? b : f == 3 ? (a+b)/2 : paeth(a,b,c);
+            unsigned char v = row[i]-p;
+            cand[f][i] = v;
+            cost += v < 128 ? v : 256-v;
+        }
+        if( best < 0 || cost < best ) {
+            best = cost;
+            bf = f;
+        }
+    }
+    out[0] = bf;
+    memcpy(out+1, &cand[bf][0], rowbytes);
+}
+
+int writepng(FILE* f, const unsigned char* raw, int cols, int rows, int channels, int depth) {
+    int bpp = channels*depth/8;
+    int rowbytes = cols*bpp;
+    int stride = rowbytes+1;
+    std::vector<unsigned char> filt((long)stride*rows);
+    parallel(rows, [&](int s, int e) {
+        for( int r = s; r < e; r++ ) filterrow(raw+(long)r*rowbytes, r > 0 ? raw+(long)(r-1)*rowbytes : NULL, rowbytes, bpp, &filt[(long)r*stride]);
+    });
+
+    int bandrows = (1<<20)/stride+1;
+    int bands = (rows+bandrows-1)/bandrows;
+    std::vector<std::vector<unsigned char> > z(bands);
+    std::vector<unsigned int> ad(bands);
+    parallel(bands, [&](int s, int e) {
+        for( int b = s; b < e; b++ ) {
+            int r0 = b*bandrows;
+            int r1 = r0+bandrows < rows ? r0+bandrows : rows;
+            const unsigned char* d = &filt[(long)r0*stride];
+            z[b] = deflateband(d, (r1-r0)*stride);
+            ad[b] = adler32(d, (r1-r0)*stride);
+        }
+    });
+
+    std::vector<unsigned char> idat;
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    unsigned int adler = 1;
+    for( int b = 0; b < bands; b++ ) {
+        idat.insert(idat.end(), z[b].begin(), z[b].end());
+        int r0 = b*bandrows;
+        int r1 = r0+bandrows < rows ? r0+bandrows : rows;
+        adler = adler32combine(adler, ad[b], (r1-r0)*stride);
     }
+    idat.push_back(0x03);
+    idat.push_back(0x00);
+    for( int k = 3; k >= 0; k-- ) idat.push_back((unsigned char)(adler>>(8*k)));
+
+    const unsigned char sig[] = {0x89,'P','N','G','\r','\n',0x1a,'\n'};
+    fwrite(sig, 1, 8, f);
+    unsigned char ihdr[13] = {(unsigned char)(cols>>24), (unsigned char)(cols>>16), (unsigned char)(cols>>8), (unsigned char)cols,
+        (unsigned char)(rows>>24), (unsigned char)(rows>>16), (unsigned char)(rows>>8), (unsigned char)rows,
+        (unsigned char)depth, (unsigned char)(channels == 1 ? 0 : channels == 2 ? 4 : channels == 3 ? 2 : 6), 0, 0, 0};
+    pngchunk(f, "IHDR", ihdr, 13);
+    int chunk = 1<<20;
+    for( long o = 0; o < (long)idat.size(); o += chunk ) {
+        int n = idat.size()-o < (unsigned long)chunk ? idat.size()-o : chunk;
+        pngchunk(f, "IDAT", &idat[o], n);
+    }
+    pngchunk(f, "IEND", NULL, 0);
     return 0;
 }
 
-extern "C" int sl_const(simlab* c) {
-    current = c;
+const char* extension(const char* file) {
+    const char* dot = strrchr(file, '.');
+    return dot ? dot+1 : "";
+}
+
+extern "C" int sl_image(int cols, int rows, const char* file) {
+    const char* ext = extension(file);
+    int channels = !strcmp(ext,"pgm") ? 1 : !strcmp(ext,"ppm") ? 3 : imagechannels;
+    int len = cols*rows*channels;
+    std::vector<unsigned short> smp(len);
+    if( tsamples(current, len, smp.data()) ) return 1;
+
+    int bytes = imagedepth/8;
+    std::vector<unsigned char> raw((long)len*bytes);
+    parallel(len, [&](int s, int e) {
+        if( bytes == 1 ) for( int i = s; i < e; i++ ) raw[i] = (unsigned char)smp[i];
+        else for( int i = s; i < e; i++ ) {
+            raw[2*i] = smp[i]>>8;
+            raw[2*i+1] = (unsigned char)smp[i];
+        }
+    });
+
+    FILE* f = fopen(file, "wb");
+    if( f == NULL ) return 1;
+    if( !strcmp(ext,"png") ) writepng(f, raw.data(), cols, rows, channels, imagedepth);
+    else {
+        fprintf(f, "P%d\n%d %d\n%d\n", channels == 1 ? 5 : 6, cols, rows, (1<<imagedepth)-1);
+        fwrite(raw.data(), 1, raw.size(), f);
+    }
+    fclose(f);
+
     return 0;
 }
 
 extern "C" int sl_convert(int cols, int rows, char* file) {
-    FILE* convert;
+    FILE* convert = NULL;
     const char *inp = "convert -size %dx%d -depth 8 rgb:- %s";
     char cmd[256];
     int len = cols*rows;
@@ -771,14 +3915,42 @@ extern "C" int sl_convert(int cols, int rows, char* file) {
     return 0;
 }
 
+int audiorate = 22000;
+int audiochannels = 1;
+int audioblock = 1024;
+int audioahead = 16;
+
+/* half precision samples are played as float */
+const char* audioformat(int type, char* cmd) {
+    const char* inp = "play --bits %d --rate %d --channels %d --encoding %s -t raw -";
+    if( type == 18 || type == 19 ) type = 34;
+    int bits = type & ~3;
+    const char* enc = (type & 3) == 2 ? "float" : (type & 1) ? "signed-integer" : "unsigned-integer";
+    sprintf(cmd,inp,bits,audiorate,audiochannels,enc);
+    return cmd;
+}
+
+extern "C" int sl_audio(int rate, int channels) {
+    audiorate = rate;
+    audiochannels = channels;
+    return 0;
+}
+
+extern "C" int sl_audiobuffer(int block, int ahead) {
+    audioblock = block;
+    audioahead = ahead;
+    return 0;
+}
+
 extern "C" int sl_play(int len) {
-    FILE* sox;
+    FILE* sox = NULL;
+    char cmd[256];
     if( current->type == 17 ) {
-        sox = popen("play --bits 16 --rate 22000 --channels 1 --encoding signed-integer -t raw -", "w");
+        sox = popen(audioformat(17,cmd), "w");
         virtualbuffer<short> & sf = *(virtualbuffer<short>*)current;
         write<short>(sf, len, sox);
     } else if( current->type == 34 ) {
-        sox = popen("play --bits 32 --rate 22000 --channels 1 --encoding float -t raw -", "w");
+        sox = popen(audioformat(34,cmd), "w");
         virtualbuffer<float> & sf = *(virtualbuffer<float>*)current;
         write<float>(sf, len, sox);
     }
@@ -787,7 +3959,305 @@ extern "C" int sl_play(int len) {
     return 0;
 }
 
-std::map<std::string,simlab*>    retlib;
+template<class T> class ringbuffer {
+public:
+    ringbuffer(int size) : cap(1), head(0), tail(0), done(false) {
+        while( cap < size ) cap <<= 1;
+        mask = cap-1;
+        buf = (T*)slalloc(cap*sizeof(T));
+    }
+    ~ringbuffer() {
+        slfree(buf);
+    }
+    T* wptr(int & n) {
+        unsigned long long h = head.load(std::memory_order_relaxed);
+        unsigned long long t = tail.load(std::memory_order_acquire);
+        int free = cap - (int)(h-t);
+        int end = cap - (int)(h&mask);
+        n = free < end ? free : end;
+        return buf+(h&mask);
+    }
+    void commit(int n) {
+        head.store(head.load(std::memory_order_relaxed)+n, std::memory_order_release);
+    }
+    const T* rptr(int & n) {
+        unsigned long long t = tail.load(std::memory_order_relaxed);
+        unsigned long long h = head.load(std::memory_order_acquire);
+        int avail = (int)(h-t);
+        int end = cap - (int)(t&mask);
+        n = avail < end ? avail : end;
+        return buf+(t&mask);
+    }
+    void release(int n) {
+        tail.store(tail.load(std::memory_order_relaxed)+n, std::memory_order_release);
+    }
+    int cap;
+    int mask;
+    T* buf;
+    std::atomic<unsigned long long> head;
+    std::atomic<unsigned long long> tail;
+    std::atomic<bool> done;
+};
+
+/* sample indices are int, so an unbounded stream ends after INT_MAX samples, an exception ends it early and is kept in error for the player */
+template<class T> void produce(virtualbuffer<T> & s, long long len, int block, ringbuffer<T> & rb, std::atomic<bool> & stop, std::exception_ptr & error) {
+    long long i = 0;
+    if( len <= 0 || len > INT_MAX ) len = INT_MAX;
+    try {
+        while( !stop.load() && i < len ) {
+            int n;
+            T* w = rb.wptr(n);
+            if( n == 0 ) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                continue;
+            }
+            if( n > block ) n = block;
+            if( n > len-i ) n = (int)(len-i);
+            s.fill(w, (int)i, n);
+            rb.commit(n);
+            i += n;
+        }
+    } catch( ... ) {
+        error = std::current_exception();
+    }
+    rb.done.store(true);
+}
+
+template<class T> long long playstream(virtualbuffer<T> & s, long long len, FILE* file) {
+    ringbuffer<T> rb(audioblock*audioahead);
+    std::atomic<bool> stop(false);
+    std::exception_ptr error;
+    std::thread producer(produce<T>, std::ref(s), len, audioblock, std::ref(rb), std::ref(stop), std::ref(error));
+
+    int n;
+    while( !rb.done.load() && rb.wptr(n) && n > 0 ) std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+    long long underruns = 0;
+    bool starved = false;
+    while( true ) {
+        const T* r = rb.rptr(n);
+        if( n == 0 ) {
+            if( rb.done.load() ) {
+                rb.rptr(n);
+                if( n == 0 ) break;
+                continue;
+            }
+            if( !starved ) underruns++;
+            starved = true;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+        starved = false;
+        if( (int)fwrite(r, sizeof(T), n, file) != n ) break;
+        rb.release(n);
+    }
+    stop.store(true);
+    producer.join();
+    fflush(file);
+    if( error ) std::rethrow_exception(error);
+    return underruns;
+}
+
+template<class T> long long splaystream(simlab* sl, long long len, FILE* file) {
+    return playstream<T>(*(virtualbuffer<T>*)sl, len, file);
+}
+
+long long tplaystream(simlab* sl, long long len, FILE* file) {
+    if( sl->type == 8 ) return splaystream<unsigned char>(sl, len, file);
+    else if( sl->type == 9 ) return splaystream<char>(sl, len, file);
+    else if( sl->type == 16 ) return splaystream<unsigned short>(sl, len, file);
+    else if( sl->type == 17 ) return splaystream<short>(sl, len, file);
+    else if( sl->type == 32 ) return splaystream<unsigned int>(sl, len, file);
+    else if( sl->type == 33 ) return splaystream<int>(sl, len, file);
+    else if( sl->type == 34 ) return splaystream<float>(sl, len, file);
+    else if( sl->type == 66 ) return splaystream<double>(sl, len, file);
+    else if( sl->type == 18 || sl->type == 19 ) {
+        simlab* f = scast<cast>(34, sl);
+        long long r = splaystream<float>(f, len, file);
+        delete f;
+        return r;
+    }
+    return -1;
+}
+
+extern "C" int sl_playstream(int len) {
+    char cmd[256];
+    signal(SIGPIPE, SIG_IGN);
+    FILE* sox = popen(audioformat(current->type,cmd), "w");
+    if( sox == NULL ) return 1;
+    long long underruns;
+    try {
+        underruns = tplaystream(current, len, sox);
+    } catch( ... ) {
+        pclose(sox);
+        throw;
+    }
+    pclose(sox);
+    printf("underruns %lld\n", underruns);
+
+    return 0;
+}
+
+extern "C" int sl_playto(int len, const char* file) {
+    signal(SIGPIPE, SIG_IGN);
+    FILE* out = fopen(file, "w");
+    if( out == NULL ) return 1;
+    long long underruns;
+    try {
+        underruns = tplaystream(current, len, out);
+    } catch( ... ) {
+        fclose(out);
+        throw;
+    }
+    fclose(out);
+    printf("underruns %lld\n", underruns);
+
+    return 0;
+}
+
+int streamwindow = 1<<20;
+thread_local FILE* commands = NULL;
+/* set in forked serve sessions, which share the server's stdin */
+bool serving = false;
+
+/* raw samples read from a file, pipe or FIFO on a background thread into a ring of streamwindow samples, space is reclaimed only behind what has been read so blocks
+   filled in parallel stay readable, a lone reader more than a window ahead skips the samples in between once the ring has been full for a while */
+template<class T> class stream : public virtualbuffer<T> {
+public:
+    struct state {
+        state(int size) : rb(size), done(0) {
+#ifndef WIN
+            pid = getpid();
+#endif
+        }
+        ringbuffer<T> rb;
+        std::mutex m;
+        std::multiset<long long> inflight;
+        long long done;
+#ifndef WIN
+        pid_t pid;
+#endif
+    };
+    stream(const char* path) : st(new state(streamwindow)) {
+        std::thread(reader, st, std::string(path)).detach();
+    }
+    static void reader(std::shared_ptr<state> st, std::string path) {
+        ringbuffer<T> & rb = st->rb;
+        FILE* f = path == "-" ? stdin : fopen(path.c_str(), "rb");
+        if( f == NULL ) printf("could not open %s\n", path.c_str());
+        int part = 0;
+        while( f != NULL ) {
+            int n;
+            T* w = rb.wptr(n);
+            if( n == 0 ) {
+                if( st.use_count() == 1 ) break;
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                continue;
+            }
+            /* a partial sample stays at the write position until the rest of it arrives */
+#ifndef WIN
+            long long got = read(fileno(f), (char*)w+part, (size_t)n*sizeof(T)-part);
+#else
+            long long got = fread((char*)w+part, 1, (size_t)n*sizeof(T)-part, f);
+#endif
+            if( got <= 0 ) break;
+            part += got;
+            rb.commit(part/sizeof(T));
+            part %= sizeof(T);
+        }
+        if( f != NULL && f != stdin ) fclose(f);
+        rb.done.store(true);
+    }
+    /* drops samples a quarter window behind the oldest block still being read, called with m held */
+    void advance(long long low) const {
+        if( !st->inflight.empty() && *st->inflight.begin() < low ) low = *st->inflight.begin();
+        long long t = low - st->rb.cap/4;
+        long long h = st->rb.head.load(std::memory_order_acquire);
+        if( t > h ) t = h;
+        if( t > (long long)st->rb.tail.load(std::memory_order_relaxed) ) st->rb.tail.store(t, std::memory_order_release);
+    }
+    virtual T operator[](int i) const {
+        T v;
+        fill(&v, i, 1);
+        return v;
+    }
+    /* the call stays registered from start to end, its entry moves up to the next chunk so nothing it still needs is dropped in between */
+    virtual void fill(T* o, int s, int n) const {
+        ringbuffer<T> & rb = st->rb;
+#ifndef WIN
+        /* a forked serve session has a copy of the ring but no reader, it ends at what was read before the fork */
+        if( st->pid != getpid() ) rb.done.store(true);
+#endif
+        int step = rb.cap/2;
+        std::multiset<long long>::iterator it;
+        {
+            std::lock_guard<std::mutex> lk(st->m);
+            it = st->inflight.insert(s);
+        }
+        for( int i = 0; i < n; i += step ) {
+            int m = n-i < step ? n-i : step;
+            long long a = (long long)s+i, b = a+m;
+            int full = 0;
+            while( !rb.done.load() && (long long)rb.head.load(std::memory_order_acquire) < b ) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                if( rb.head.load()-rb.tail.load() < (unsigned long long)rb.cap ) continue;
+                if( full < 1000 ) {
+                    full++;
+                    continue;
+                }
+                std::lock_guard<std::mutex> lk(st->m);
+                if( st->inflight.size() == 1 ) advance(a);
+            }
+            long long h = rb.head.load(std::memory_order_acquire), t = rb.tail.load(std::memory_order_acquire);
+            for( long long j = a; j < b; j++ ) o[i+j-a] = j >= t && j < h ? rb.buf[j&rb.mask] : T(0);
+            std::lock_guard<std::mutex> lk(st->m);
+            st->inflight.erase(it);
+            it = st->inflight.insert(b);
+            if( b > st->done ) st->done = b;
+            advance(st->done);
+        }
+        std::lock_guard<std::mutex> lk(st->m);
+        st->inflight.erase(it);
+    }
+    std::shared_ptr<state> st;
+};
+
+extern "C" int sl_streamwindow(int n) {
+    streamwindow = n > 0 ? n : 1;
+    return 0;
+}
+
+/* stream "path" type, "-" reads stdin when commands come from elsewhere (embedded sessions) */
+extern "C" int sl_stream(const char* path, simlab* sl) {
+    int type = (*(virtualbuffer<int>*)sl)[0];
+    if( !strcmp(path, "-") && commands == stdin ) {
+        printf("stream - needs stdin, which is reading commands\n");
+        return 1;
+    }
+    if( !strcmp(path, "-") && serving ) {
+        printf("stream - is not available to serve sessions, they share the server's stdin\n");
+        return 1;
+    }
+    if( type == 8 ) current = new stream<unsigned char>(path);
+    else if( type == 9 ) current = new stream<char>(path);
+    else if( type == 16 ) current = new stream<unsigned short>(path);
+    else if( type == 17 ) current = new stream<short>(path);
+    else if( type == 18 ) current = new stream<half>(path);
+    else if( type == 19 ) current = new stream<bhalf>(path);
+    else if( type == 32 ) current = new stream<unsigned int>(path);
+    else if( type == 33 ) current = new stream<int>(path);
+    else if( type == 34 ) current = new stream<float>(path);
+    else if( type == 64 ) current = new stream<unsigned long long>(path);
+    else if( type == 65 ) current = new stream<long long>(path);
+    else if( type == 66 ) current = new stream<double>(path);
+    else {
+        printf("unknown type %d\n", type);
+        return 1;
+    }
+    return 0;
+}
+
+thread_local std::map<std::string,simlab*>    retlib;
 
 extern "C" int sl_fetch(const char* buf) {
     std::string var(buf);
@@ -803,6 +4273,337 @@ extern "C" int sl_store(const char* buf) {
     return 0;
 }
 
+int evalblock = 4096;
+
+int typesize(int type) {
+    if( type == 8 || type == 9 ) return 1;
+    if( type == 16 || type == 17 || type == 18 || type == 19 ) return 2;
+    if( type == 32 || type == 33 || type == 34 ) return 4;
+    if( type == 64 || type == 65 || type == 66 ) return 8;
+    return 0;
+}
+
+void getany(simlab* sl, void* o, int s, int n) {
+    if( sl->type == 8 ) {
+        ((virtualbuffer<unsigned char>*)sl)->get((unsigned char*)o, s, n);
+    } else if( sl->type == 9 ) {
+        ((virtualbuffer<char>*)sl)->get((char*)o, s, n);
+    } else if( sl->type == 16 ) {
+        ((virtualbuffer<unsigned short>*)sl)->get((unsigned short*)o, s, n);
+    } else if( sl->type == 17 ) {
+        ((virtualbuffer<short>*)sl)->get((short*)o, s, n);
+    } else if( sl->type == 32 ) {
+        ((virtualbuffer<unsigned int>*)sl)->get((unsigned int*)o, s, n);
+    } else if( sl->type == 33 ) {
+        ((virtualbuffer<int>*)sl)->get((int*)o, s, n);
+    } else if( sl->type == 34 ) {
+        ((virtualbuffer<float>*)sl)->get((float*)o, s, n);
+    } else if( sl->type == 64 ) {
+        ((virtualbuffer<unsigned long long>*)sl)->get((unsigned long long*)o, s, n);
+    } else if( sl->type == 65 ) {
+        ((virtualbuffer<long long>*)sl)->get((long long*)o, s, n);
+    } else if( sl->type == 66 ) {
+        ((virtualbuffer<double>*)sl)->get((double*)o, s, n);
+    } else if( sl->type == 18 ) {
+        ((virtualbuffer<half>*)sl)->get((half*)o, s, n);
+    } else if( sl->type == 19 ) {
+        ((virtualbuffer<bhalf>*)sl)->get((bhalf*)o, s, n);
+    }
+}
+
+simlab* newbufferof(int type, int len) {
+    if( type == 8 ) {
+        return new buffer<unsigned char>(len);
+    } else if( type == 9 ) {
+        return new buffer<char>(len);
+    } else if( type == 16 ) {
+        return new buffer<unsigned short>(len);
+    } else if( type == 17 ) {
+        return new buffer<short>(len);
+    } else if( type == 32 ) {
+        return new buffer<unsigned int>(len);
+    } else if( type == 33 ) {
+        return new buffer<int>(len);
+    } else if( type == 34 ) {
+        return new buffer<float>(len);
+    } else if( type == 64 ) {
+        return new buffer<unsigned long long>(len);
+    } else if( type == 65 ) {
+        return new buffer<long long>(len);
+    } else if( type == 66 ) {
+        return new buffer<double>(len);
+    } else if( type == 18 ) {
+        return new buffer<half>(len);
+    } else if( type == 19 ) {
+        return new buffer<bhalf>(len);
+    }
+    return NULL;
+}
+
+/* counts the parents of every node reachable from sl, children come before parents in order */
+void parents(simlab* sl, std::map<simlab*,int> & refs, std::vector<simlab*> & order) {
+    std::map<simlab*,int>::iterator it = refs.find(sl);
+    if( it != refs.end() ) {
+        it->second++;
+        return;
+    }
+    refs[sl] = 1;
+    for( int k = 0; k < sl->inputs(); k++ ) parents(sl->input(k), refs, order);
+    order.push_back(sl);
+}
+
+/* evaluates the stored expressions "a b c" over len in one pass, a name>path writes that result to a file instead of storing it */
+extern "C" int sl_eval_many(int len, const char* names) {
+    std::vector<std::string> name, path;
+    std::vector<simlab*> roots;
+    char* list = strdup(names);
+    char* save = NULL;
+    for( char* t = strtok_r(list, " ", &save); t != NULL; t = strtok_r(NULL, " ", &save) ) {
+        std::string n(t), f;
+        size_t gt = n.find('>');
+        if( gt != std::string::npos ) {
+            f = n.substr(gt+1);
+            n = n.substr(0, gt);
+        }
+        std::map<std::string,simlab*>::iterator it = retlib.find(n);
+        if( it == retlib.end() || it->second == NULL ) {
+            printf("no stored expression %s\n", n.c_str());
+            free(list);
+            return 1;
+        }
+        name.push_back(n);
+        path.push_back(f);
+        roots.push_back(it->second);
+    }
+    free(list);
+    std::map<simlab*,int> refs;
+    std::vector<simlab*> order, shared;
+    for( size_t r = 0; r < roots.size(); r++ ) parents(roots[r], refs, order);
+    for( size_t k = 0; k < order.size(); k++ ) {
+        if( refs[order[k]] > 1 && order[k]->data() == NULL ) shared.push_back(order[k]);
+    }
+    if( len <= 0 ) {
+        printf("eval_many needs a positive length\n");
+        return 1;
+    }
+    std::vector<simlab*> out(roots.size());
+    for( size_t r = 0; r < roots.size(); r++ ) out[r] = newbufferof(roots[r]->type, len);
+    int B = evalblock > 0 ? evalblock : 4096;
+    int nb = (len+B-1)/B;
+    long long cached = 0;
+    for( size_t k = 0; k < shared.size(); k++ ) cached += (long long)B*typesize(shared[k]->type);
+    scratch sp(cached*(threads < nb ? threads : nb));
+    parallel(nb, [&](int b0, int b1) {
+        std::vector<memo> tab(shared.size());
+        std::vector<std::vector<char> > cache(shared.size());
+        for( size_t k = 0; k < shared.size(); k++ ) cache[k].resize((size_t)B*typesize(shared[k]->type));
+        memoscope ms(tab.empty() ? NULL : &tab[0], shared.size());
+        for( int blk = b0; blk < b1; blk++ ) {
+            int s = blk*B, n = len-s < B ? len-s : B;
+            for( size_t k = 0; k < shared.size(); k++ ) {
+                tab[k].node = shared[k];
+                tab[k].s = 0;
+                tab[k].n = 0;
+                tab[k].cap = B;
+                tab[k].data = cache[k].data();
+            }
+            for( size_t r = 0; r < roots.size(); r++ ) getany(roots[r], (char*)out[r]->data()+(size_t)s*typesize(roots[r]->type), s, n);
+        }
+    });
+    for( size_t r = 0; r < roots.size(); r++ ) {
+        if( path[r].empty() ) {
+            retlib[name[r]] = out[r];
+            current = out[r];
+            continue;
+        }
+        FILE* f = fopen(path[r].c_str(), "wb");
+        if( f == NULL || fwrite(out[r]->data(), typesize(out[r]->type), len, f) != (size_t)len ) printf("could not write %s\n", path[r].c_str());
+        if( f != NULL ) fclose(f);
+        delete out[r];
+    }
+    return 0;
+}
+
+extern "C" int sl_evalblock(int block) {
+    evalblock = block;
+    return 0;
+}
+
+/* distinct nodes and materialized bytes reachable from sl */
+void footprint(const simlab* sl, std::set<const simlab*> & seen, long long & nodes, long long & bytes) {
+    if( sl == NULL || !seen.insert(sl).second ) return;
+    nodes++;
+    if( sl->data() != NULL ) bytes += (long long)sl->length*typesize(sl->type);
+    for( int k = 0; k < sl->inputs(); k++ ) footprint(sl->input(k), seen, nodes, bytes);
+}
+
+void memline(const char* name, const simlab* sl) {
+    std::set<const simlab*> seen;
+    long long nodes = 0, bytes = 0;
+    footprint(sl, seen, nodes, bytes);
+    printf("%-16s %4d %12d %8lld %14lld\n", name, sl->type, sl->length, nodes, bytes);
+}
+
+extern "C" int sl_mem() {
+    long long total = 0, high = 0;
+    printf("%-16s %14s %14s\n", "", "bytes", "high");
+    for( int c = 0; c < 4; c++ ) {
+        printf("%-16s %14lld %14lld\n", memnames[c], memused[c].load(), memhigh[c].load());
+        total += memused[c];
+        high += memhigh[c];
+    }
+    printf("%-16s %14lld %14lld\n", "total", total, high);
+    if( memlimit > 0 ) printf("%-16s %14lld\n", "limit", memlimit);
+    printf("\n%-16s %4s %12s %8s %14s\n", "", "type", "length", "nodes", "data");
+    if( current != NULL ) memline("current", current);
+    for( std::map<std::string,simlab*>::iterator it = retlib.begin(); it != retlib.end(); it++ ) {
+        simlab* sl = it->second;
+        if( sl != NULL && (sl->inputs() > 0 || sl->data() != NULL) ) memline(it->first.c_str(), sl);
+    }
+    return 0;
+}
+
+/* hard limit in megabytes on the accounted total, 0 for none; the counters are per process, so embedded sessions share them while serve sessions, being forked, each have their own */
+extern "C" int sl_memlimit(int mb) {
+    memlimit = (long long)mb << 20;
+    return 0;
+}
+
+std::map<std::string,sl_kernel> kernels;
+std::mutex kernelm;
+extern long long module;
+inline long dsym( long long handle, const char* symbol );
+
+/* node running a plugin kernel over tiles of its inputs */
+template<class T> class kernelnode : public virtualbuffer<T> {
+public:
+    kernelnode(const sl_kernel & k, const std::vector<simlab*> & v) : kn(k), in(v) {}
+    virtual T operator[](int i) const {
+        T v;
+        fill(&v, i, 1);
+        return v;
+    }
+    /* short reads, like single elements, use tiles on the stack */
+    virtual void fill(T* o, int s, int n) const {
+        const int S = 16;
+        if( n <= S ) {
+            double t[SL_MAXINPUTS*S];
+            tiles(o, s, n, (char*)t, S);
+            return;
+        }
+        const int B = 1024;
+        scratch sc((long long)in.size()*B*8);
+        std::vector<char> t(in.size()*B*8);
+        tiles(o, s, n, t.data(), B);
+    }
+    void tiles(T* o, int s, int n, char* t, int B) const {
+        const void* p[SL_MAXINPUTS];
+        for( int i = 0; i < n; i += B ) {
+            int m = n-i < B ? n-i : B;
+            for( size_t k = 0; k < in.size(); k++ ) {
+                p[k] = t+k*B*8;
+                getany(in[k], t+k*B*8, s+i, m);
+            }
+            kn.fn(o+i, p, m, (long long)s+i, kn.ctx);
+        }
+    }
+    virtual int inputs() const { return in.size(); }
+    virtual simlab* input(int k) const { return in[k]; }
+    virtual bool pointwise() const { return (kn.flags & SL_POINTWISE) != 0; }
+    sl_kernel kn;
+    std::vector<simlab*> in;
+};
+
+/* built-in commands are looked up first, so a kernel of the same name could never run, the name is kept in the table key */
+int registerkernel(const sl_kernel* k) {
+    if( k == NULL || k->name == NULL || k->fn == NULL || k->nin < 0 || k->nin > SL_MAXINPUTS || typesize(k->out_type) == 0 ) return 1;
+    std::string cmdname = std::string("sl_")+k->name;
+    if( dsym( module, cmdname.c_str() ) != 0 ) {
+        printf("kernel %s has the name of a command\n", k->name);
+        return 1;
+    }
+    std::lock_guard<std::mutex> lk(kernelm);
+    std::map<std::string,sl_kernel>::iterator it = kernels.insert(std::make_pair(std::string(k->name), *k)).first;
+    it->second = *k;
+    it->second.name = it->first.c_str();
+    return 0;
+}
+
+extern "C" int sl_loadplugin(const char* path) {
+#ifndef WIN
+    void* h = dlopen(path, RTLD_NOW|RTLD_LOCAL);
+    if( h == NULL ) {
+        printf("%s\n", dlerror());
+        return 1;
+    }
+    sl_plugin_init_fn init = (sl_plugin_init_fn)dlsym(h, "sl_plugin_init");
+#else
+    HMODULE h = LoadLibrary(path);
+    sl_plugin_init_fn init = h != NULL ? (sl_plugin_init_fn)GetProcAddress(h, "sl_plugin_init") : NULL;
+#endif
+    if( init == NULL || init(SL_PLUGIN_ABI, registerkernel) != 0 ) {
+        printf("%s is not a simlab plugin\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+bool findkernel(const char* name, sl_kernel & k) {
+    std::lock_guard<std::mutex> lk(kernelm);
+    std::map<std::string,sl_kernel>::iterator it = kernels.find(name);
+    if( it == kernels.end() ) return false;
+    k = it->second;
+    return true;
+}
+
+template<class T> simlab* subkernel(const sl_kernel & k, const std::vector<simlab*> & in) {
+    return new kernelnode<T>(k, in);
+}
+
+/* kernel(current, args...) with the inputs cast to the declared types */
+int applykernel(const sl_kernel & k, const std::vector<simlab*> & args) {
+    if( (int)args.size() != k.nin ) {
+        printf("%s takes %d inputs\n", k.name, k.nin);
+        return 1;
+    }
+    std::vector<simlab*> in(args);
+    for( size_t j = 0; j < in.size(); j++ ) {
+        if( in[j]->type != k.in_types[j] ) in[j] = scast<cast>(k.in_types[j], in[j]);
+        if( in[j] == NULL ) {
+            printf("%s has an unknown input type\n", k.name);
+            return 1;
+        }
+    }
+    simlab* r = NULL;
+    if( k.out_type == 8 ) {
+        r = subkernel<unsigned char>(k, in);
+    } else if( k.out_type == 9 ) {
+        r = subkernel<char>(k, in);
+    } else if( k.out_type == 16 ) {
+        r = subkernel<unsigned short>(k, in);
+    } else if( k.out_type == 17 ) {
+        r = subkernel<short>(k, in);
+    } else if( k.out_type == 32 ) {
+        r = subkernel<unsigned int>(k, in);
+    } else if( k.out_type == 33 ) {
+        r = subkernel<int>(k, in);
+    } else if( k.out_type == 34 ) {
+        r = subkernel<float>(k, in);
+    } else if( k.out_type == 64 ) {
+        r = subkernel<unsigned long long>(k, in);
+    } else if( k.out_type == 65 ) {
+        r = subkernel<long long>(k, in);
+    } else if( k.out_type == 66 ) {
+        r = subkernel<double>(k, in);
+    } else if( k.out_type == 18 ) {
+        r = subkernel<half>(k, in);
+    } else if( k.out_type == 19 ) {
+        r = subkernel<bhalf>(k, in);
+    }
+    if( r != NULL ) current = r;
+    return 0;
+}
+
 inline long dopen( char* name ) {
 #ifndef WIN
 	return (long)dlopen( name, RTLD_GLOBAL );
@@ -826,16 +4627,19 @@ struct passa {
 };
 template<> struct passa<0>{};
 
-int			bsize;
-unsigned long long passcurr;
-passa<31>	passnext;
-char    passargs[8];
-int passi;
+thread_local int			bsize;
+thread_local unsigned long long passcurr;
+thread_local passa<31>	passnext;
+thread_local char    passargs[8];
+thread_local int passi;
+thread_local char* tokens;
+thread_local std::vector<char*> literals;
 
 long long module = 0;
-extern "C" int sl_init() {
-    module = dopen( NULL );
+std::once_flag moduleonce;
 
+/* the names every session starts with */
+void initlib() {
     retlib["zero"] = new cnst<int>(0);
     retlib["one"] = new cnst<int>(1);
     retlib["two"] = new cnst<int>(2);
@@ -860,25 +4664,35 @@ extern "C" int sl_init() {
     retlib["ulong"] = new cnst<int>(64);
     retlib["long"] = new cnst<int>(65);
     retlib["double"] = new cnst<int>(66);
+    retlib["half"] = new cnst<int>(18);
+    retlib["float16"] = new cnst<int>(18);
+    retlib["bfloat16"] = new cnst<int>(19);
 
     retlib["idx"] = new idx();
+}
+
+extern "C" int sl_init() {
+    std::call_once(moduleonce, []() { module = dopen( NULL ); });
+    initlib();
 
     return 0;
 }
 
 int parseParameters( int bytesize ) {
-	char *result = strtok( NULL, " ,)\n" );
+	char *result = strtok_r( NULL, " ,)\n", &tokens );
 	if( result != NULL ) {
 		if( result[0] == '"' || result[0] == '.' ) {
 			std::string str = result;
 			if( str[ str.length()-1 ] != '"' ) {
-				char *rs = strtok( NULL, "\"" );
+				char *rs = strtok_r( NULL, "\"", &tokens );
 				str += " ";
 				str += rs;
 				str += "\"";
 			}
 
+			account( MEMLITERALS, str.length()-1 );
 			char*	c_str = new char[ str.length()-1 ];
+            literals.push_back( c_str );
 			str.copy( c_str, str.length()-2, 1 );
 			c_str[ str.length() - 2 ] = 0;
 
@@ -899,12 +4713,12 @@ int parseParameters( int bytesize ) {
 			sscanf( result+1, "%e", &fval );
 			d_vec.push_back( (double)fval );
 
-			result = strtok( NULL, " ,)\n" );
+			result = strtok_r( NULL, " ,)\n", &tokens );
 			len = strlen(result);
 			while( result[ len-1 ] != ']' ) {
 				sscanf( result, "%e", &fval );
 				d_vec.push_back( (double)fval );
-				result = strtok( NULL, " ,)\n" );
+				result = strtok_r( NULL, " ,)\n", &tokens );
 				len = strlen(result);
 			}
 			sscanf( result, "%e]", &fval );
@@ -1020,12 +4834,11 @@ here:
 				char* here = (char*)&passnext;
 				here += bytesize;
                 simlab* sl;
-                if( result[k] = 'f' ) sl = new cnst<float>(value);
-                else sl = new cnst<double>(value);
+                if( result[k] == 'f' ) sl = new cnst<float>((float)dvalue);
+                else sl = new cnst<double>(dvalue);
 
                 passargs[passi] = 'p';
                 passi++;
-                printf("%f\n", (*(virtualbuffer<float>*)sl)[0]);
 
 				memcpy( here, &sl, sizeof(simlab*) );
 				return parseParameters( bytesize+sizeof(simlab*) );
@@ -1060,14 +4873,18 @@ here:
                 passi++;
 
 				//data = tmp;
-				return parseParameters( bytesize+sizeof(simlab) );
+				return parseParameters( bytesize+sizeof(simlab*) );
 			} else {
 				long fnc = dsym( module, result );
 				if( strcmp( result, "prev" ) == 0 ) {
 					char* here = (char*)&passnext;
 					here += bytesize;
-					memcpy( here, &prev, sizeof(simlab) );
-					return parseParameters( bytesize+sizeof(simlab) );
+					memcpy( here, &prev, sizeof(simlab*) );
+
+                    passargs[passi] = 'p';
+                    passi++;
+
+					return parseParameters( bytesize+sizeof(simlab*) );
 				} else if( strcmp( result, "len" ) == 0 ) {
 					char* here = (char*)&passnext;
 					here += bytesize;
@@ -1078,10 +4895,13 @@ here:
 				} else if( fnc != 0 ) {
 					char* here = (char*)&passnext;
 					here += bytesize;
-					buffer<unsigned int> fdata(0);
-                    fdata.buf = (unsigned int*)fnc;
-					memcpy( here, &fdata, sizeof(fdata) );
-					return parseParameters( bytesize+sizeof(virtualbuffer<unsigned int>) );
+					void* fdata = (void*)fnc;
+					memcpy( here, &fdata, sizeof(void*) );
+
+                    passargs[passi] = 'p';
+                    passi++;
+
+					return parseParameters( bytesize+sizeof(void*) );
 				} else {
 					sl_fetch( result );
 
@@ -1112,15 +4932,45 @@ here:
 	return bytesize;
 }
 
+int argoffset(int k) {
+    int off = 0;
+    for( int i = 0; i < k; i++ ) off += passargs[i] == 'i' ? sizeof(int) : sizeof(void*);
+    return off;
+}
+
+int argi(int k) {
+    int v;
+    memcpy( &v, (char*)&passnext+argoffset(k), sizeof(int) );
+    return v;
+}
+
+void* argp(int k) {
+    void* p;
+    memcpy( &p, (char*)&passnext+argoffset(k), sizeof(void*) );
+    return p;
+}
+
+/* string arguments live until the command returns */
+void freeliterals() {
+    for( size_t k = 0; k < literals.size(); k++ ) {
+        account( MEMLITERALS, -(long long)(strlen(literals[k])+1) );
+        delete [] literals[k];
+    }
+    literals.clear();
+}
+
 extern "C" int cmd( char* command ) {
+    int err = 0;
 	if( *command == '"' ) {
 		command[ strlen(command)-1 ] = 0;
 		buffer<char> str;
 		str.buf = (char*)(command+1);
 		//echo( str );
 	} else { //if( *command != '\n' ) {
-		char*	result = strtok( command, " (\n" );
+		char*	result = strtok_r( command, " (\n", &tokens );
 		long long func = dsym( module, result );
+        sl_kernel kn;
+        try {
 		//int (*func)() = (int (*)())dsym( module, result );
 		if( func != 0 ) {//&& (java == 0 || func == (long)store || func == (long)fetch || func == (long)Class || func == (long)New || func == (long)Data || func == (long)create) ) {
 			//int (*func)() = (int (*)())dsym( module, "welcome" );
@@ -1155,6 +5005,21 @@ extern "C" int cmd( char* command ) {
                 //printf("lptr %lld %lld\n", (long long)p, (long long)ptr);
                 //printf("ok %d %d %s\n", ((int*)&passnext)[0], ((int*)&passnext)[1], ptr);
 			    ((int (*)(int,int,const char*))func)( ((int*)&passnext)[0], ((int*)&passnext)[1], ptr );
+            } else if( passargs[0] == 'p' && passargs[1] == 'p' && passargs[2] == 0 ) {
+                ((int (*)(void*,void*))func)( argp(0), argp(1) );
+            } else if( passargs[0] == 'p' && passargs[1] == 'i' && passargs[2] == 0 ) {
+                ((int (*)(void*,int))func)( argp(0), argi(1) );
+            } else if( passargs[0] == 'p' && passargs[1] == 'i' && passargs[2] == 'i' && passargs[3] == 'i' && passargs[4] == 0 ) {
+                ((int (*)(void*,int,int,int))func)( argp(0), argi(1), argi(2), argi(3) );
+            } else if( passargs[0] == 'i' && passargs[1] == 'i' && passargs[2] == 'p' && passargs[3] == 'p' && passargs[4] == 0 ) {
+                ((int (*)(int,int,void*,void*))func)( argi(0), argi(1), argp(2), argp(3) );
+            } else if( passargs[0] == 'i' && passargs[1] == 'p' && passargs[2] == 'p' && passargs[3] == 0 ) {
+                ((int (*)(int,void*,void*))func)( argi(0), argp(1), argp(2) );
+            } else if( passargs[0] == 'i' && passargs[1] == 'p' && passargs[2] == 0 ) {
+                ((int (*)(int,void*))func)( argi(0), argp(1) );
+            } else if( argoffset(passi) == bsize ) {
+                printf( "bad arguments for %s\n", result+3 );
+                err = 1;
             } else {
                 ((int (*)(...))func)( passnext );
             }
@@ -1164,16 +5029,27 @@ extern "C" int cmd( char* command ) {
             /*if( old.buffer != 0 && (data.buffer < old.buffer || data.buffer > old.buffer+bytelength(old.type,old.length)) ) {
 				prev = old;
 			}*/
+		} else if( findkernel(result+3, kn) ) {
+			memset( &passnext, 0, sizeof(passnext) );
+            memset( passargs, 0, sizeof(passargs) );
+            passi = 0;
+			parseParameters( 0 );
+            std::vector<simlab*> args(1, current);
+            for( int k = 0; passargs[k] == 'p'; k++ ) args.push_back((simlab*)argp(k));
+            applykernel(kn, args);
 		} else printf( "No such command %s\n", result, command );
+        } catch( std::bad_alloc & ) {
+            printf( "out of memory in %s\n", result+3 );
+            err = 1;
+        }
+        freeliterals();
 	}
 
-	return 0;
+	return err;
 }
 
-int main(int argc, char** argv) {
-    sl_init();
-
-    FILE*	f = stdin;
+int session(FILE* f) {
+    commands = f;
     char	line[256];
     strcpy(line,"sl_s");
     int offset = strlen(line)-1;
@@ -1186,12 +5062,122 @@ int main(int argc, char** argv) {
 	while( res != NULL && strncmp( line+offset, quit, sizeof(quit)-1 ) ) {
 		//s_line.length = strlen(line);
 		if( *line != '\n' ) fnc( line );
+        fflush( stdout );
 		res = fgets( line+offset, sizeof(line), (FILE*)f );
 	}
 
     return 0;
 }
 
+#ifndef WIN
+void reapsessions(int sig) {
+    int e = errno;
+    while( waitpid(-1, NULL, WNOHANG) > 0 ) {}
+    errno = e;
+}
+#endif
+
+/* every connection runs in a fork of the server, sessions start from the server state and share its buffers copy-on-write */
+extern "C" int sl_serve(const char* path) {
+#ifndef WIN
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+    unlink(path);
+    if( s < 0 || bind(s, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 64) != 0 ) {
+        printf("could not listen on %s\n", path);
+        if( s >= 0 ) close(s);
+        return 1;
+    }
+    signal(SIGCHLD, reapsessions);
+    fflush(stdout);
+    while( true ) {
+        int c = accept(s, NULL, NULL);
+        if( c < 0 ) {
+            if( errno == EINTR ) continue;
+            printf("accept failed: %s\n", strerror(errno));
+            fflush(stdout);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        pool.hold();
+        pid_t pid = fork();
+        pool.release();
+        if( pid < 0 ) {
+            printf("could not fork a session: %s\n", strerror(errno));
+            fflush(stdout);
+        } else if( pid == 0 ) {
+            signal(SIGCHLD, SIG_DFL);
+            close(s);
+            serving = true;
+            pool.reset();
+            dup2(c, 1);
+            FILE* f = fdopen(c, "r");
+            session(f);
+            fflush(stdout);
+            _exit(0);
+        }
+        close(c);
+    }
+#else
+    printf("serve is not supported\n");
+    return 1;
+#endif
+}
+
+struct slsession {
+    slsession() : current(NULL), prev(NULL), owned(&nodes) {}
+    simlab* current;
+    simlab* prev;
+    std::map<std::string,simlab*> retlib;
+    std::set<void*> nodes;
+    std::set<void*>* owned;
+};
+
+void swapsession(slsession* s) {
+    std::swap(current, s->current);
+    std::swap(prev, s->prev);
+    std::swap(retlib, s->retlib);
+    std::swap(owned, s->owned);
+}
+
+/* an independent pipeline for embedding, a session may move between threads but runs one command at a time */
+extern "C" void* sl_session_new() {
+    slsession* s = new slsession();
+    swapsession(s);
+    sl_init();
+    swapsession(s);
+    return s;
+}
+
+extern "C" int sl_session_cmd(void* s, const char* line) {
+    std::vector<char> command(strlen(line)+5);
+    strcpy(&command[0], "sl_");
+    strcat(&command[0], line);
+    slsession* ss = (slsession*)s;
+    swapsession(ss);
+    int r = cmd(&command[0]);
+    swapsession(ss);
+    return r;
+}
+
+/* deletes every node the session created, which also returns its buffers */
+extern "C" void sl_session_free(void* s) {
+    slsession* ss = (slsession*)s;
+    std::set<void*> nodes;
+    nodes.swap(ss->nodes);
+    for( std::set<void*>::iterator it = nodes.begin(); it != nodes.end(); ++it ) delete (simlab*)*it;
+    delete ss;
+}
+
+int main(int argc, char** argv) {
+    sl_init();
+
+    return session(stdin);
+}
+
 int main10(int argc, char** argv) {
     idx ix;
     current = &ix;
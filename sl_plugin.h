@@ -0,0 +1,51 @@
+/* C interface for simlab kernel plugins.
+ *
+ * A plugin is a shared object exporting sl_plugin_init. It is loaded with
+ * "loadplugin "path.so"" and registers any number of block kernels. Each
+ * registered kernel becomes a command of the same name that replaces the
+ * current buffer with kernel(current, args...), where args are stored names.
+ * Names of built-in commands are refused.
+ *
+ * Kernels are called on contiguous tiles: out holds n elements of out_type,
+ * in[k] holds n elements of in_types[k] starting at the same index. Inputs
+ * of another type are cast before the call. fn is called concurrently from
+ * several threads on different tiles, so it and ctx must be thread safe.
+ * Type codes are the simlab ones: 8 uchar, 9 char, 16 ushort, 17 short,
+ * 18 float16, 19 bfloat16, 32 uint, 33 int, 34 float, 64 ulong, 65 long,
+ * 66 double.
+ */
+#ifndef SL_PLUGIN_H
+#define SL_PLUGIN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SL_PLUGIN_ABI 1
+#define SL_MAXINPUTS 4
+
+/* out[i] depends only on in[k][i], lets the evaluator tabulate, cache and track edits through the kernel */
+#define SL_POINTWISE 1
+
+typedef void (*sl_kernel_fn)(void* out, const void* const* in, int n, long long start, void* ctx);
+
+typedef struct sl_kernel {
+    const char* name;
+    int out_type;
+    int nin;
+    int in_types[SL_MAXINPUTS];
+    int flags;
+    sl_kernel_fn fn;
+    void* ctx;
+} sl_kernel;
+
+typedef int (*sl_register_fn)(const sl_kernel* kernel);
+
+/* exported by the plugin, returns 0 on success */
+typedef int (*sl_plugin_init_fn)(int abi, sl_register_fn reg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif